@@ -0,0 +1,265 @@
+#include "console.h"
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "descriptors.h"
+#include "encoder.h"
+#include "events.h"
+#include "health.h"
+#include "keymap.h"
+#include "settings.h"
+#include "timebase.h"
+#include "timing.h"
+
+/* Single character commands read from the CDC serial port; replies are plain text.
+ * Commands that take arguments collect the rest of the line before running. */
+
+#define CONSOLE_LINE_SIZE 40
+
+/* Most numbers any command takes */
+#define CONSOLE_MAX_NUMBERS (ENCODER_ACCEL_BANDS > 1 + KEYMAP_NUM_KEYS ? ENCODER_ACCEL_BANDS : 1 + KEYMAP_NUM_KEYS)
+
+static FILE *console_stream;
+
+static char line_command = 0;
+static char line[CONSOLE_LINE_SIZE];
+static uint8_t line_length;
+
+static bool echo_events = false;
+static sEventReader console_events;
+
+static const char pin_names[NUM_PINS][6] PROGMEM =
+{
+  [ENC_LEFT_A]  = "VL_A",
+  [ENC_LEFT_B]  = "VL_B",
+  [ENC_RIGHT_A] = "VR_A",
+  [ENC_RIGHT_B] = "VR_B",
+  [BT_A]        = "BT_A",
+  [BT_B]        = "BT_B",
+  [BT_C]        = "BT_C",
+  [BT_D]        = "BT_D",
+  [FX_L]        = "FX_L",
+  [FX_R]        = "FX_R",
+  [START]       = "START",
+};
+
+static const char timing_names[NUM_TIMINGS][8] PROGMEM =
+{
+  [TIMING_LOOP]            = "loop",
+  [TIMING_SAMPLE_LATENESS] = "s.late",
+  [TIMING_SAMPLE_COST]     = "s.cost",
+  [TIMING_EDGE_TO_REPORT]  = "edge>kb",
+  [TIMING_USB]             = "usb",
+  [TIMING_REPORT_STAGE]    = "stage",
+  [TIMING_SAMPLE_TO_FRAME] = "s>frame",
+};
+
+void ConsoleInit(FILE *stream)
+{
+  console_stream = stream;
+}
+
+static void ConsolePrintHelp(void)
+{
+  fputs_P(PSTR("h: switch and knob health  H: reset health  t: timing  T: reset timing\r\n"
+               "e: echo button events on/off  D: restore default settings\r\n"
+               "k: knob settings  g <left> <right>: knob gain (256 = 1x)\r\n"
+               "a <8 values>: acceleration per speed band (16 = 1x)\r\n"
+               "m: keymap  b <layer> <7 usages>: bind BT_A..START (layer 1 is START held)\r\n"
+               "p <profile>: USB profile from the next plug-in (0 full, 1 tournament)\r\n"), console_stream);
+}
+
+static void ConsolePrintHealth(void)
+{
+  fputs_P(PSTR("pin   trig presses bursts edges maxedges maxrun chatter | bounce ticks 0 1 2-3 4-7 8-15 16-31 32-63 64+\r\n"), console_stream);
+  for (ePinId p = HEALTH_FIRST_PIN; p < NUM_PINS; p++) {
+    sSwitchHealth h;
+    HealthGet(p, &h);
+    fprintf_P(console_stream, PSTR("%-5S %4u %7u %6u %5u %8u %6u %7u |"),
+              pin_names[p], settings.trigger_count[p], h.presses, h.bursts, h.edges,
+              h.max_edges, h.max_run, h.chatter);
+    for (uint8_t b = 0; b < HEALTH_BOUNCE_BUCKETS; b++) {
+      fprintf_P(console_stream, PSTR(" %u"), h.bounce_hist[b]);
+    }
+    fputs_P(PSTR("\r\n"), console_stream);
+  }
+
+  fputs_P(PSTR("knob  illegal jitter\r\n"), console_stream);
+  for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+    sEncoderStats stats;
+    EncoderGetStats(k, &stats);
+    fprintf_P(console_stream, PSTR("%-5S %7u %6u\r\n"), k == KNOB_LEFT ? PSTR("VOL_L") : PSTR("VOL_R"),
+              stats.illegal, stats.jitter);
+  }
+}
+
+static void ConsolePrintTiming(void)
+{
+  fputs_P(PSTR("timing       count    p50 us    p99 us    max us\r\n"), console_stream);
+  for (eTimingId t = 0; t < NUM_TIMINGS; t++) {
+    sTimingSummary summary;
+    TimingGet(t, &summary);
+    fprintf_P(console_stream, PSTR("%-7S %10lu %9lu %9lu %9lu\r\n"), timing_names[t], summary.count,
+              summary.p50 / TIMEBASE_CYCLES_PER_US, summary.p99 / TIMEBASE_CYCLES_PER_US,
+              summary.max / TIMEBASE_CYCLES_PER_US);
+  }
+}
+
+static void ConsolePrintKnobs(void)
+{
+  fprintf_P(console_stream, PSTR("gain %u %u\r\naccel"), settings.knob_gain[KNOB_LEFT],
+            settings.knob_gain[KNOB_RIGHT]);
+  for (uint8_t b = 0; b < ENCODER_ACCEL_BANDS; b++) {
+    fprintf_P(console_stream, PSTR(" %u"), settings.knob_accel[b]);
+  }
+  fprintf_P(console_stream, PSTR("\r\nbands start at %u steps/s and double\r\n"),
+            1 << ENCODER_ACCEL_FIRST_SHIFT);
+}
+
+static void ConsolePrintKeymap(void)
+{
+  for (uint8_t l = 0; l < KEYMAP_LAYERS; l++) {
+    fprintf_P(console_stream, PSTR("layer %u"), l);
+    for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+      fprintf_P(console_stream, PSTR(" %S=%u"), pin_names[KEYMAP_FIRST_PIN + k], settings.keymap[l][k]);
+    }
+    fputs_P(PSTR("\r\n"), console_stream);
+  }
+}
+
+/* Parses up to count unsigned numbers no larger than max from the line.
+ * Returns false, leaving values partly filled, if there are fewer or one is too big. */
+static bool ConsoleParseNumbers(uint16_t *values, uint8_t count, uint16_t max)
+{
+  char *p = line;
+
+  for (uint8_t i = 0; i < count; i++) {
+    char *end;
+    unsigned long value = strtoul(p, &end, 10);
+    if (end == p || value > max) return false;
+    values[i] = value;
+    p = end;
+  }
+  return true;
+}
+
+static void ConsoleRunLine(void)
+{
+  uint16_t values[CONSOLE_MAX_NUMBERS];
+  uint8_t codes[KEYMAP_NUM_KEYS];
+
+  switch (line_command) {
+    case 'g':
+      if (!ConsoleParseNumbers(values, NUM_KNOBS, UINT16_MAX)) break;
+      // The gains are read by reports built in interrupts
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+          settings.knob_gain[k] = values[k];
+        }
+      }
+      SettingsSave();
+      ConsolePrintKnobs();
+      return;
+    case 'a':
+      if (!ConsoleParseNumbers(values, ENCODER_ACCEL_BANDS, UINT8_MAX)) break;
+      for (uint8_t b = 0; b < ENCODER_ACCEL_BANDS; b++) {
+        settings.knob_accel[b] = values[b];
+      }
+      SettingsSave();
+      ConsolePrintKnobs();
+      return;
+    case 'b':
+      if (!ConsoleParseNumbers(values, 1 + KEYMAP_NUM_KEYS, UINT8_MAX)) break;
+      for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+        codes[k] = values[1 + k];
+      }
+      if (!KeymapSetLayer(values[0], codes)) break;
+      ConsolePrintKeymap();
+      return;
+    case 'p':
+      if (!ConsoleParseNumbers(values, 1, USB_PROFILE_COUNT - 1)) break;
+      settings.usb_profile = values[0];
+      SettingsSave();
+      fprintf_P(console_stream, PSTR("profile %u from the next plug-in\r\n"), settings.usb_profile);
+      return;
+  }
+  fputs_P(PSTR("bad arguments\r\n"), console_stream);
+}
+
+void ConsoleProcessByte(int16_t c)
+{
+  if (c < 0) return;
+
+  if (line_command) {
+    if (c == '\r' || c == '\n') {
+      line[line_length] = '\0';
+      ConsoleRunLine();
+      line_command = 0;
+    } else if (line_length < CONSOLE_LINE_SIZE - 1) {
+      line[line_length++] = c;
+    }
+    return;
+  }
+
+  switch (c) {
+    case 'h':
+      ConsolePrintHealth();
+      break;
+    case 'H':
+      HealthReset();
+      EncoderResetStats();
+      break;
+    case 't':
+      ConsolePrintTiming();
+      break;
+    case 'T':
+      TimingReset();
+      break;
+    case 'e':
+      echo_events = !echo_events;
+      EventsReaderInit(&console_events);
+      break;
+    case 'D':
+      SettingsApplyDefaults();
+      break;
+    case 'k':
+      ConsolePrintKnobs();
+      break;
+    case 'm':
+      ConsolePrintKeymap();
+      break;
+    case 'g':
+    case 'a':
+    case 'b':
+    case 'p':
+      line_command = c;
+      line_length = 0;
+      break;
+    case '?':
+      ConsolePrintHelp();
+      break;
+  }
+}
+
+/* Prints button events as they happen while echo is on */
+void ConsoleUpdate(void)
+{
+  sInputEvent event;
+
+  if (!echo_events) return;
+
+  while (EventsPeek(&console_events, &event)) {
+    EventsConsume(&console_events);
+    fprintf_P(console_stream, PSTR("%10lu %-5S %S\r\n"), event.time_us, pin_names[event.pin],
+              event.level ? PSTR("up") : PSTR("down"));
+  }
+  if (console_events.overrun) {
+    console_events.overrun = false;
+    fputs_P(PSTR("events lost\r\n"), console_stream);
+  }
+}
@@ -0,0 +1,12 @@
+#ifndef CONSOLE_H_
+#define CONSOLE_H_
+
+#include "console.h"
+#include <stdio.h>
+#include <stdint.h>
+
+void ConsoleInit(FILE *stream);
+void ConsoleProcessByte(int16_t c);
+void ConsoleUpdate(void);
+
+#endif /* CONSOLE_H_ */
\ No newline at end of file
@@ -1,161 +1,461 @@
 #include "debounce.h"
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-#define DEBOUNCE_TIMER_COMPARE_COUNT   63 // 0.25 ms @ 250 kHz
-#define DEBOUNCE_TRIGGER_COUNT_BUTTON  3
-#define DEBOUNCE_TRIGGER_COUNT_ENCODER 1
+#include "encoder.h"
+#include "events.h"
+#include "health.h"
+#include "reports.h"
+#include "settings.h"
+#include "timebase.h"
+#include "timing.h"
+
+/* Pick the smallest Timer0 prescaler that can reach the sample rate */
+#if (F_CPU / 8 / DEBOUNCE_SAMPLE_RATE_HZ) <= 256
+#define DEBOUNCE_TIMER_CLOCK_SELECT    (1 << CS01)                 // 8 prescale div -> 2 MHz
+#define DEBOUNCE_TIMER_CLOCK_HZ        (F_CPU / 8)
+#elif (F_CPU / 64 / DEBOUNCE_SAMPLE_RATE_HZ) <= 256
+#define DEBOUNCE_TIMER_CLOCK_SELECT    ((1 << CS01) | (1 << CS00)) // 64 prescale div -> 250 kHz
+#define DEBOUNCE_TIMER_CLOCK_HZ        (F_CPU / 64)
+#else
+#error DEBOUNCE_SAMPLE_RATE_HZ is too low for Timer0
+#endif
+#define DEBOUNCE_TIMER_COMPARE_COUNT   ((DEBOUNCE_TIMER_CLOCK_HZ + DEBOUNCE_SAMPLE_RATE_HZ / 2) / DEBOUNCE_SAMPLE_RATE_HZ - 1)
+
+#if DEBOUNCE_SOF_LOCK
+#if DEBOUNCE_SAMPLE_RATE_HZ % 1000
+#error SOF lock needs a whole number of samples per USB frame
+#endif
+/* Timer0 counts from the start of frame to the first sample of the frame */
+#define DEBOUNCE_SOF_FIRST_COUNTS      (DEBOUNCE_TIMER_CLOCK_HZ / 1000 - \
+                                        DEBOUNCE_SOF_LEAD_US * DEBOUNCE_TIMER_CLOCK_HZ / 1000000 - \
+                                        (DEBOUNCE_SAMPLE_RATE_HZ / 1000 - 1) * (DEBOUNCE_TIMER_COMPARE_COUNT + 1))
+#if DEBOUNCE_SOF_FIRST_COUNTS < 0 || DEBOUNCE_SOF_FIRST_COUNTS > DEBOUNCE_TIMER_COMPARE_COUNT
+#error DEBOUNCE_SOF_LEAD_US must fit in one sample period
+#endif
+#endif
+
+/* Timer1 cycles in one USB frame */
+#define DEBOUNCE_FRAME_CYCLES          (F_CPU / 1000)
+
+#if DEBOUNCE_EAGER && DEBOUNCE_ENGINE != DEBOUNCE_ENGINE_VERTICAL
+#error Eager debounce requires the vertical counter engine
+#endif
+
+/* The lockout counts down in a byte, and a lockout of 0 ticks would wrap to 255 */
+#if DEBOUNCE_EAGER && DEBOUNCE_EAGER_LOCKOUT_TICKS < 1
+#error DEBOUNCE_EAGER_LOCKOUT_US must be at least one sample period
+#endif
+#if DEBOUNCE_EAGER && DEBOUNCE_EAGER_LOCKOUT_TICKS > 255
+#error DEBOUNCE_EAGER_LOCKOUT_US must be at most 255 sample periods
+#endif
+
+/* Eager pins that can interrupt: BT_D (INT0), FX_R (INT1), BT_C (INT2) */
+#define DEBOUNCE_EAGER_INT_MASK_D      ((1 << 0) | (1 << 1) | (1 << 2))
 
 typedef struct {
   uint8_t count;
-  const uint8_t trigger_count;
   bool level;
   const uint8_t mask;
-  const volatile uint8_t *port;
+  const ePortId port;
+  const bool eager;
 } sPinRef;
 
+/* Debounce state for all 8 bits of a port, stored as bit planes so that
+ * every pin on the port is counted with a handful of bitwise operations. */
+typedef struct {
+  uint8_t sample;     // Raw level of each bit at the previous tick
+  uint8_t level;      // Debounced level of each bit
+  uint8_t tick_level; // Debounced level as of the previous tick
+  uint8_t cnt0;       // Consecutive samples differing from level, bit 0
+  uint8_t cnt1;       // ... bit 1
+  uint8_t cnt2;       // ... bit 2
+  uint8_t trig0;      // Per-bit trigger count, bit 0
+  uint8_t trig1;      // ... bit 1
+  uint8_t trig2;      // ... bit 2
+#if DEBOUNCE_EAGER
+  uint8_t eager;      // Bits debounced by lockout instead of counting
+  uint8_t locked;     // Eager bits currently inside their lockout window
+  uint8_t lockout[8]; // Remaining lockout ticks of each bit
+#endif
+} sPortRef;
+
+static const volatile uint8_t * const port_regs[NUM_PORTS] = { &PINB, &PIND, &PINE };
+
+static sPortRef ports[NUM_PORTS];
+
+/* Which button each port bit belongs to, for turning level changes into events.
+ * The encoder pins are left out; encoder.c decodes them on its own. */
+static uint8_t port_pin_masks[NUM_PORTS];
+static uint8_t bit_pins[NUM_PORTS][8];
+
 static sPinRef pins[NUM_PINS] =
 {
   {
     /* ENC_LEFT_A */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_ENCODER,
     .level = 0,
     .mask = (1 << 4),
-    .port = &PINB
+    .port = PORT_B
   },
   {
     /* ENC_LEFT_B */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_ENCODER,
     .level = 0,
     .mask = (1 << 5),
-    .port = &PINB
+    .port = PORT_B
   },
   {
     /* ENC_RIGHT_A */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_ENCODER,
     .level = 0,
     .mask = (1 << 0),
-    .port = &PINB
+    .port = PORT_B
   },
   {
     /* ENC_RIGHT_B */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_ENCODER,
     .level = 0,
     .mask = (1 << 7),
-    .port = &PINB
+    .port = PORT_B
   },
   {
     /* BT_A */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_ENCODER,
     .level = 0,
     .mask = (1 << 7),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* BT_B */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 4),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* BT_C */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 2),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* BT_D */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 0),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* FX-L */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 6),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* FX-R */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 1),
-    .port = &PIND
+    .port = PORT_D,
+    .eager = true
   },
   {
     /* Start */
     .count = 0,
-    .trigger_count = DEBOUNCE_TRIGGER_COUNT_BUTTON,
     .level = 0,
     .mask = (1 << 2),
-    .port = &PINE
+    .port = PORT_E,
+    .eager = true
   },
 };
 
+static uint16_t sample_tick = 0;
+
+/* Timer1 cycles at the last sample and at the last start of frame */
+static volatile uint16_t sample_cycles;
+static volatile uint16_t frame_cycles;
+static volatile bool frame_seen = false;
+
 void DebounceInit(void)
 {
+  for (ePortId p = 0; p < NUM_PORTS; p++) {
+    ports[p].sample = *port_regs[p];
+  }
+
+  /* Trigger counts come from the stored (possibly self-calibrated) settings */
+  for (ePinId p = 0; p < NUM_PINS; p++) {
+    DebounceSetTriggerCount(p, settings.trigger_count[p]);
+    if (p >= BT_A) {
+      port_pin_masks[pins[p].port] |= pins[p].mask;
+      for (uint8_t b = 0; b < 8; b++) {
+        if (pins[p].mask & (1 << b)) bit_pins[pins[p].port][b] = p;
+      }
+    }
+#if DEBOUNCE_EAGER
+    if (pins[p].eager) ports[pins[p].port].eager |= pins[p].mask;
+#endif
+  }
+
+#if DEBOUNCE_EAGER
+  /* Interrupt on any edge of the eager pins that have an external interrupt */
+  EICRA |= (1 << ISC00) | (1 << ISC10) | (1 << ISC20);
+  EIFR = (1 << INTF0) | (1 << INTF1) | (1 << INTF2);
+  EIMSK |= (1 << INT0) | (1 << INT1) | (1 << INT2);
+#endif
+
   /* Setup Debounce Timer */
-  TCCR0A |= (1 << COM0A1) | (1 << COM0A0); // Set OC0A to compare
+  TCCR0A |= (1 << WGM01);                  // Clear timer on compare match
   TCNT0 = 0;                               // Reset timer count
   OCR0A = DEBOUNCE_TIMER_COMPARE_COUNT;    // Compare value
   TIFR0 = (1 << OCF0A);                    // Clear compare flag
-  TCCR0B |= (1 << CS01) | (1 << CS00);     // Select clock : 64 prescale div -> 250 kHz
+  TIMSK0 |= (1 << OCIE0A);                 // Sample from the compare interrupt
+  TCCR0B |= DEBOUNCE_TIMER_CLOCK_SELECT;   // Select clock
 }
 
-static uint8_t stat_previous_cnt = 0;
-
-sDebounceStats debounce_stats = {0, 0xff, 0};
+#if DEBOUNCE_ENGINE == DEBOUNCE_ENGINE_PER_PIN
 
-void DebounceUpdate(void)
+static void DebounceSample(void)
 {
-  // Has our sample timer triggered?
-  if (TIFR0 & (1 << OCF0A)) {
-    for (ePinId p = 0; p < NUM_PINS; p++) {
-      sPinRef *pr = &pins[p];
-      if (pr->level != (bool) (pr->mask & *(pr->port))) {
-        pr->count++;
-        if (pr->count > pr->trigger_count) {
-          pr->level = !pr->level;
-          pr->count = 0;
-        }
-      } else {
+  for (ePinId p = 0; p < NUM_PINS; p++) {
+    sPinRef *pr = &pins[p];
+    if (pr->level != (bool) (pr->mask & *port_regs[pr->port])) {
+      pr->count++;
+      if (pr->count > settings.trigger_count[p]) {
+        pr->level = !pr->level;
         pr->count = 0;
+        if (p >= BT_A) {
+          EventsPush(p, pr->level, TimebaseMicros());
+          ReportsStageButtons();
+        }
       }
+    } else {
+      pr->count = 0;
     }
-    // Reset sample timer
-    TIFR0 = (1 << OCF0A);
-    TCNT0 = 0;
-    stat_previous_cnt = 0;
-  } else {
-    // Collect statistics on scheduling rate
-    uint8_t current_cnt = TCNT0;
-    if (current_cnt > stat_previous_cnt) {
-      uint8_t delta = current_cnt - stat_previous_cnt;
-      // Exponential moving average for simplicity
-      debounce_stats.avg = 0.3 * delta + (1 - 0.3) * debounce_stats.avg;
-      if (delta < debounce_stats.min) debounce_stats.min = delta;
-      if (delta > debounce_stats.max) debounce_stats.max = delta;
+  }
+}
+
+#else
+
+/* Queues an event for every pin whose debounced level just changed, then puts the
+ * new state in front of the host without waiting for the main loop */
+static void DebounceEmit(ePortId id, uint8_t changed)
+{
+  changed &= port_pin_masks[id];
+  if (!changed) return;
+
+  uint32_t now = TimebaseMicros();
+  for (uint8_t b = 0; b < 8; b++) {
+    if (changed & (1 << b)) {
+      EventsPush(bit_pins[id][b], ports[id].level & (1 << b), now);
+    }
+  }
+  ReportsStageButtons();
+}
+
+#if DEBOUNCE_EAGER
+
+/* Register edges on unlocked eager bits immediately and start their lockout */
+static inline void DebounceEagerEdges(ePortId id, uint8_t sample, uint8_t mask)
+{
+  sPortRef *port = &ports[id];
+  uint8_t edges = (sample ^ port->level) & mask & ~port->locked;
+  if (edges) {
+    port->level ^= edges;
+    port->locked |= edges;
+    for (uint8_t b = 0; b < 8; b++) {
+      if (edges & (1 << b)) port->lockout[b] = DEBOUNCE_EAGER_LOCKOUT_TICKS;
     }
+    DebounceEmit(id, edges);
   }
 }
 
+static inline void DebounceTickLockout(sPortRef *port)
+{
+  for (uint8_t b = 0; b < 8; b++) {
+    if ((port->locked & (1 << b)) && --port->lockout[b] == 0) {
+      port->locked &= ~(1 << b);
+    }
+  }
+}
+
+ISR(INT0_vect)
+{
+  DebounceEagerEdges(PORT_D, PIND, DEBOUNCE_EAGER_INT_MASK_D);
+}
+ISR(INT1_vect, ISR_ALIASOF(INT0_vect));
+ISR(INT2_vect, ISR_ALIASOF(INT0_vect));
+
+#endif
+
+static inline void DebounceSamplePort(ePortId id, uint8_t sample)
+{
+  sPortRef *port = &ports[id];
+
+#if DEBOUNCE_EAGER
+  if (port->locked) DebounceTickLockout(port);
+  DebounceEagerEdges(id, sample, port->eager);
+  uint8_t changed = (sample ^ port->level) & ~port->eager;
+#else
+  uint8_t changed = sample ^ port->level;
+#endif
+  // Bits whose count has reached their trigger count
+  uint8_t expired = ~((port->cnt0 ^ port->trig0) |
+                      (port->cnt1 ^ port->trig1) |
+                      (port->cnt2 ^ port->trig2));
+  uint8_t counting = changed & ~expired;
+  uint8_t toggled = changed & expired;
+
+  port->level ^= toggled;
+
+  // Increment the counters of bits still waiting, clear all others
+  port->cnt2 = (port->cnt2 ^ (port->cnt1 & port->cnt0)) & counting;
+  port->cnt1 = (port->cnt1 ^ port->cnt0) & counting;
+  port->cnt0 = ~port->cnt0 & counting;
+
+  DebounceEmit(id, toggled);
+  HealthSample(id, sample ^ port->sample, port->tick_level ^ port->level, port->level, sample_tick);
+  port->sample = sample;
+  port->tick_level = port->level;
+}
+
+static void DebounceSample(void)
+{
+  sample_tick++;
+  DebounceSamplePort(PORT_B, PINB);
+  DebounceSamplePort(PORT_D, PIND);
+  DebounceSamplePort(PORT_E, PINE);
+}
+
+#endif
+
+/* Inputs are sampled (and the encoders decoded, unless they have their own
+ * interrupt) here at a fixed rate, so sample timing no longer depends on how
+ * long the main loop takes */
+ISR(TIMER0_COMPA_vect)
+{
+  // TCNT0 restarted from 0 at the compare match, so it tells how late we are
+  uint8_t late = TCNT0;
+  uint16_t start = TimebaseCycles();
+
+  sample_cycles = start;
+  DebounceSample();
+#if !ENCODER_USE_PCINT
+  EncoderUpdate();
+#endif
+
+  TimingRecord(TIMING_SAMPLE_COST, (uint16_t) (TimebaseCycles() - start));
+  TimingRecord(TIMING_SAMPLE_LATENESS, (uint16_t) late * (F_CPU / DEBOUNCE_TIMER_CLOCK_HZ));
+}
+
 bool DebounceGetLevel(ePinId id)
 {
+#if DEBOUNCE_ENGINE == DEBOUNCE_ENGINE_PER_PIN
   return pins[id].level;
+#else
+  return ports[pins[id].port].level & pins[id].mask;
+#endif
+}
+
+uint8_t DebounceGetPort(ePortId port)
+{
+#if DEBOUNCE_ENGINE == DEBOUNCE_ENGINE_PER_PIN
+  uint8_t level = 0;
+  for (ePinId p = 0; p < NUM_PINS; p++) {
+    if (pins[p].port == port && pins[p].level) level |= pins[p].mask;
+  }
+  return level;
+#else
+  return ports[port].level;
+#endif
+}
+
+void DebounceSetTriggerCount(ePinId id, uint8_t trigger_count)
+{
+  sPortRef *port = &ports[pins[id].port];
+  uint8_t mask = pins[id].mask;
+
+  if (trigger_count > DEBOUNCE_TRIGGER_COUNT_MAX) trigger_count = DEBOUNCE_TRIGGER_COUNT_MAX;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    port->trig0 = (trigger_count & (1 << 0)) ? (port->trig0 | mask) : (port->trig0 & ~mask);
+    port->trig1 = (trigger_count & (1 << 1)) ? (port->trig1 | mask) : (port->trig1 & ~mask);
+    port->trig2 = (trigger_count & (1 << 2)) ? (port->trig2 | mask) : (port->trig2 & ~mask);
+    // A count above the new trigger would never match it, so restart counting
+    port->cnt0 &= ~mask;
+    port->cnt1 &= ~mask;
+    port->cnt2 &= ~mask;
+  }
 }
 
+ePortId DebounceGetPinPort(ePinId id)
+{
+  return pins[id].port;
+}
+
+uint8_t DebounceGetPinMask(ePinId id)
+{
+  return pins[id].mask;
+}
+
+/* Called from the start of frame interrupt. With DEBOUNCE_SOF_LOCK the sample timer restarts
+ * so the first sample of the frame comes DEBOUNCE_SOF_FIRST_COUNTS from now. Crystal drift
+ * against the host's frame clock can't build up, and a sample that was due sooner is moved,
+ * not dropped. */
+void DebounceFrame(void)
+{
+  frame_cycles = TimebaseCycles();
+  frame_seen = true;
+
+#if DEBOUNCE_SOF_LOCK
+  TCNT0 = DEBOUNCE_TIMER_COMPARE_COUNT - DEBOUNCE_SOF_FIRST_COUNTS;
+#endif
+}
+
+/* Cycles from the newest sample to the start of the next USB frame, which is the earliest the
+ * host polls a report staged now. Zero before the first frame. */
+uint16_t DebounceGetSampleAge(void)
+{
+  uint16_t sample;
+  uint16_t frame;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!frame_seen) return 0;
+    sample = sample_cycles;
+    frame = frame_cycles;
+  }
+
+  return (uint16_t) (frame + DEBOUNCE_FRAME_CYCLES) - sample;
+}
+
+/* TimebaseMicros() at the newest sample */
+uint32_t DebounceGetSampleTime(void)
+{
+  uint32_t now;
+  uint16_t age;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    now = TimebaseMicros();
+    age = TimebaseCycles() - sample_cycles;
+  }
+
+  return now - age / TIMEBASE_CYCLES_PER_US;
+}
+
+/* Timer1 cycles until the next sample tick is due, 0 if it is already pending. Call with
+ * interrupts off, so the tick can't come and go before the answer is used. */
+uint16_t DebounceGetCyclesToSample(void)
+{
+  if (TIFR0 & (1 << OCF0A)) return 0;
+  return (uint16_t) (DEBOUNCE_TIMER_COMPARE_COUNT - TCNT0) * (F_CPU / DEBOUNCE_TIMER_CLOCK_HZ);
+}
\ No newline at end of file
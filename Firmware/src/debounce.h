@@ -6,13 +6,47 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-typedef struct {
-  uint8_t avg;
-  uint8_t min;
-  uint8_t max;
-} sDebounceStats;
+/* Debounce engines; select with -DDEBOUNCE_ENGINE=... to compare sample cost */
+#define DEBOUNCE_ENGINE_PER_PIN  0 // One counter per pin, walks every pin each tick
+#define DEBOUNCE_ENGINE_VERTICAL 1 // Bitwise vertical counters, one pass per port
 
-extern sDebounceStats debounce_stats;
+#ifndef DEBOUNCE_ENGINE
+#define DEBOUNCE_ENGINE DEBOUNCE_ENGINE_VERTICAL
+#endif
+
+/* Default trigger counts, in sample ticks; see settings.c */
+#define DEBOUNCE_TRIGGER_COUNT_BUTTON  3
+#define DEBOUNCE_TRIGGER_COUNT_ENCODER 1
+#define DEBOUNCE_TRIGGER_COUNT_MAX     7  // Vertical counters are 3 bits deep
+
+/* Rate of the sample interrupt; trigger counts and lockouts are in sample ticks */
+#ifndef DEBOUNCE_SAMPLE_RATE_HZ
+#define DEBOUNCE_SAMPLE_RATE_HZ 4000
+#endif
+
+/* Eager mode: button edges are registered on the first sample (or pin interrupt)
+ * that sees them, after which the pin is ignored for the lockout window */
+#ifndef DEBOUNCE_EAGER
+#define DEBOUNCE_EAGER 0
+#endif
+
+#ifndef DEBOUNCE_EAGER_LOCKOUT_US
+#define DEBOUNCE_EAGER_LOCKOUT_US 5000
+#endif
+
+/* SOF lock: the start of frame interrupt re-phases the sample timer every USB frame, so the
+ * last sample of each frame lands DEBOUNCE_SOF_LEAD_US before the next frame starts and the
+ * host polls. Needs a sample rate that is a whole multiple of 1 kHz. */
+#ifndef DEBOUNCE_SOF_LOCK
+#define DEBOUNCE_SOF_LOCK 0
+#endif
+
+#ifndef DEBOUNCE_SOF_LEAD_US
+#define DEBOUNCE_SOF_LEAD_US 50
+#endif
+
+/* Left untyped so the preprocessor can range check it; see debounce.c */
+#define DEBOUNCE_EAGER_LOCKOUT_TICKS (DEBOUNCE_EAGER_LOCKOUT_US * DEBOUNCE_SAMPLE_RATE_HZ / 1000000)
 
 typedef enum {
   ENC_LEFT_A = 0,
@@ -29,8 +63,22 @@ typedef enum {
   NUM_PINS
 } ePinId;
 
+typedef enum {
+  PORT_B = 0,
+  PORT_D,
+  PORT_E,
+  NUM_PORTS
+} ePortId;
+
 void DebounceInit(void);
-void DebounceUpdate(void);
 bool DebounceGetLevel(ePinId id);
+uint8_t DebounceGetPort(ePortId port);
+void DebounceSetTriggerCount(ePinId id, uint8_t trigger_count);
+ePortId DebounceGetPinPort(ePinId id);
+uint8_t DebounceGetPinMask(ePinId id);
+void DebounceFrame(void);
+uint16_t DebounceGetSampleAge(void);
+uint32_t DebounceGetSampleTime(void);
+uint16_t DebounceGetCyclesToSample(void);
 
 #endif /* DEBOUNCE_H_ */
\ No newline at end of file
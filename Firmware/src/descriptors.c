@@ -37,6 +37,7 @@
 
 #include "descriptors.h"
 
+uint8_t USB_Profile = USB_PROFILE_Full;
 
 /** HID class report descriptor. This is a special descriptor constructed with values from the
  *  USBIF HID class specification to describe the reports and capabilities of the HID device. This
@@ -46,53 +47,351 @@
  */
 const USB_Descriptor_HIDReport_Datatype_t PROGMEM MouseReport[] =
 {
-	/* Use the HID class driver's standard Mouse report.
-	 *   Min X/Y Axis values: -1
-	 *   Max X/Y Axis values:  1
-	 *   Min physical X/Y Axis values (used to determine resolution): -1
-	 *   Max physical X/Y Axis values (used to determine resolution):  1
-	 *   Buttons: 3
-	 *   Absolute screen coordinates: false
+	/* Relative pointer with 16-bit axes, laid out as USB_KnobReport_Data_t.
+	 *   Min X/Y Axis values: -32767
+	 *   Max X/Y Axis values:  32767
+	 *   Buttons: 1
+	 * The standard HID_DESCRIPTOR_MOUSE report only has 8-bit axes, which a fast spin
+	 * between two polls can overflow. The vendor-defined fields after the axes carry
+	 * each knob's speed and the time since its last step, so host software can
+	 * interpolate between polls. Mouse drivers ignore them.
 	 */
-	HID_DESCRIPTOR_MOUSE(-100, 100, -100, 100, 1, false)
+	HID_RI_USAGE_PAGE(8, 0x01),
+	HID_RI_USAGE(8, 0x02),
+	HID_RI_COLLECTION(8, 0x01),
+		HID_RI_USAGE(8, 0x01),
+		HID_RI_COLLECTION(8, 0x00),
+			HID_RI_USAGE_PAGE(8, 0x09),
+			HID_RI_USAGE_MINIMUM(8, 0x01),
+			HID_RI_USAGE_MAXIMUM(8, 0x01),
+			HID_RI_LOGICAL_MINIMUM(8, 0x00),
+			HID_RI_LOGICAL_MAXIMUM(8, 0x01),
+			HID_RI_REPORT_COUNT(8, 0x01),
+			HID_RI_REPORT_SIZE(8, 0x01),
+			HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+			HID_RI_REPORT_COUNT(8, 0x01),
+			HID_RI_REPORT_SIZE(8, 0x07),
+			HID_RI_INPUT(8, HID_IOF_CONSTANT),
+			HID_RI_USAGE_PAGE(8, 0x01),
+			HID_RI_USAGE(8, 0x30),
+			HID_RI_USAGE(8, 0x31),
+			HID_RI_LOGICAL_MINIMUM(16, -32767),
+			HID_RI_LOGICAL_MAXIMUM(16, 32767),
+			HID_RI_PHYSICAL_MINIMUM(16, -32767),
+			HID_RI_PHYSICAL_MAXIMUM(16, 32767),
+			HID_RI_REPORT_COUNT(8, 0x02),
+			HID_RI_REPORT_SIZE(8, 0x10),
+			HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
+			HID_RI_USAGE_PAGE(16, 0xFF00),
+			HID_RI_USAGE(8, 0x01),
+			HID_RI_USAGE(8, 0x02),
+			HID_RI_LOGICAL_MINIMUM(16, -32767),
+			HID_RI_LOGICAL_MAXIMUM(16, 32767),
+			HID_RI_REPORT_COUNT(8, 0x02),
+			HID_RI_REPORT_SIZE(8, 0x10),
+			HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+			HID_RI_USAGE(8, 0x03),
+			HID_RI_USAGE(8, 0x04),
+			HID_RI_LOGICAL_MINIMUM(8, 0x00),
+			HID_RI_LOGICAL_MAXIMUM(16, 32767),
+			HID_RI_REPORT_COUNT(8, 0x02),
+			HID_RI_REPORT_SIZE(8, 0x10),
+			HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_END_COLLECTION(0),
+	HID_RI_END_COLLECTION(0),
 };
 
+#if USB_COMPOSITE_HID
+/** Combined report for USB_COMPOSITE_HID: the seven buttons followed by the same knob axes and
+ *  timing fields as MouseReport, laid out as USB_KnobReport_Data_t. Hosts don't treat a joystick
+ *  with relative axes as a keyboard or a pointer, so only software that opens the interface
+ *  itself sees the input. Keyboard and mouse collections under report IDs would need a report
+ *  each, and give up the single report per frame this option is for.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM InputReport[] =
+{
+	HID_RI_USAGE_PAGE(8, 0x01),
+	HID_RI_USAGE(8, 0x04),
+	HID_RI_COLLECTION(8, 0x01),
+		HID_RI_USAGE_PAGE(8, 0x09),
+		HID_RI_USAGE_MINIMUM(8, 0x01),
+		HID_RI_USAGE_MAXIMUM(8, 0x07),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_LOGICAL_MAXIMUM(8, 0x01),
+		HID_RI_REPORT_COUNT(8, 0x07),
+		HID_RI_REPORT_SIZE(8, 0x01),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_REPORT_COUNT(8, 0x01),
+		HID_RI_REPORT_SIZE(8, 0x01),
+		HID_RI_INPUT(8, HID_IOF_CONSTANT),
+		HID_RI_USAGE_PAGE(8, 0x01),
+		HID_RI_USAGE(8, 0x30),
+		HID_RI_USAGE(8, 0x31),
+		HID_RI_LOGICAL_MINIMUM(16, -32767),
+		HID_RI_LOGICAL_MAXIMUM(16, 32767),
+		HID_RI_REPORT_COUNT(8, 0x02),
+		HID_RI_REPORT_SIZE(8, 0x10),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_RELATIVE),
+		HID_RI_USAGE_PAGE(16, 0xFF00),
+		HID_RI_USAGE(8, 0x01),
+		HID_RI_USAGE(8, 0x02),
+		HID_RI_REPORT_COUNT(8, 0x02),
+		HID_RI_REPORT_SIZE(8, 0x10),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_USAGE(8, 0x03),
+		HID_RI_USAGE(8, 0x04),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_REPORT_COUNT(8, 0x02),
+		HID_RI_REPORT_SIZE(8, 0x10),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+	HID_RI_END_COLLECTION(0),
+};
+#elif USB_JOYSTICK_HID
+/** Gamepad report for USB_JOYSTICK_HID: the seven buttons followed by the knob positions as
+ *  absolute X and Y axes, laid out as USB_JoystickReport_Data_t. The axes wrap, so a knob can
+ *  turn forever without hitting an end stop.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM InputReport[] =
+{
+	HID_RI_USAGE_PAGE(8, 0x01),
+	HID_RI_USAGE(8, 0x05),
+	HID_RI_COLLECTION(8, 0x01),
+		HID_RI_USAGE_PAGE(8, 0x09),
+		HID_RI_USAGE_MINIMUM(8, 0x01),
+		HID_RI_USAGE_MAXIMUM(8, 0x07),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_LOGICAL_MAXIMUM(8, 0x01),
+		HID_RI_REPORT_COUNT(8, 0x07),
+		HID_RI_REPORT_SIZE(8, 0x01),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_REPORT_COUNT(8, 0x01),
+		HID_RI_REPORT_SIZE(8, 0x01),
+		HID_RI_INPUT(8, HID_IOF_CONSTANT),
+		HID_RI_USAGE_PAGE(8, 0x01),
+		HID_RI_USAGE(8, 0x30),
+		HID_RI_USAGE(8, 0x31),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_LOGICAL_MAXIMUM(32, 0xFFFF),
+		HID_RI_REPORT_COUNT(8, 0x02),
+		HID_RI_REPORT_SIZE(8, 0x10),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE | HID_IOF_WRAP),
+	HID_RI_END_COLLECTION(0),
+};
+#endif
+
 /** Same as the MouseReport structure, but defines the keyboard HID interface's report structure. */
 const USB_Descriptor_HIDReport_Datatype_t PROGMEM KeyboardReport[] =
 {
-	/* Use the HID class driver's standard Keyboard report.
-	 *   Max simultaneous keys: 6
+	/* N-key rollover keyboard, laid out as USB_NKROKeyboardReport_Data_t.
+	 *   Modifiers: one bit each
+	 *   Keys: one bit each for usages 0 to KEYBOARD_BITMAP_KEYS - 1
+	 * Hosts that select the boot protocol get the standard 6-slot report instead.
 	 */
-	HID_DESCRIPTOR_KEYBOARD(6)
+	HID_RI_USAGE_PAGE(8, 0x01),
+	HID_RI_USAGE(8, 0x06),
+	HID_RI_COLLECTION(8, 0x01),
+		HID_RI_USAGE_PAGE(8, 0x07),
+		HID_RI_USAGE_MINIMUM(8, 0xE0),
+		HID_RI_USAGE_MAXIMUM(8, 0xE7),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_LOGICAL_MAXIMUM(8, 0x01),
+		HID_RI_REPORT_SIZE(8, 0x01),
+		HID_RI_REPORT_COUNT(8, 0x08),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_USAGE_PAGE(8, 0x08),
+		HID_RI_USAGE_MINIMUM(8, 0x01),
+		HID_RI_USAGE_MAXIMUM(8, 0x05),
+		HID_RI_REPORT_COUNT(8, 0x05),
+		HID_RI_OUTPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE | HID_IOF_NON_VOLATILE),
+		HID_RI_REPORT_COUNT(8, 0x03),
+		HID_RI_OUTPUT(8, HID_IOF_CONSTANT),
+		HID_RI_USAGE_PAGE(8, 0x07),
+		HID_RI_USAGE_MINIMUM(8, 0x00),
+		HID_RI_USAGE_MAXIMUM(8, KEYBOARD_BITMAP_KEYS - 1),
+		HID_RI_REPORT_COUNT(8, KEYBOARD_BITMAP_KEYS),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+	HID_RI_END_COLLECTION(0),
+};
+
+#if USB_RAW_HID
+/** Vendor-defined report for the raw configuration and telemetry interface. The input report
+ *  carries sRawTelemetry, the output and feature reports carry sRawCommand, and reading the
+ *  feature report returns sRawReply. All of them are RAW_REPORT_SIZE opaque bytes.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM RawReport[] =
+{
+	HID_RI_USAGE_PAGE(16, 0xFF01),
+	HID_RI_USAGE(8, 0x01),
+	HID_RI_COLLECTION(8, 0x01),
+		HID_RI_LOGICAL_MINIMUM(8, 0x00),
+		HID_RI_LOGICAL_MAXIMUM(16, 0x00FF),
+		HID_RI_REPORT_SIZE(8, 0x08),
+		HID_RI_REPORT_COUNT(8, RAW_REPORT_SIZE),
+		HID_RI_USAGE(8, 0x02),
+		HID_RI_INPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE),
+		HID_RI_USAGE(8, 0x03),
+		HID_RI_OUTPUT(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE | HID_IOF_NON_VOLATILE),
+		HID_RI_USAGE(8, 0x04),
+		HID_RI_FEATURE(8, HID_IOF_DATA | HID_IOF_VARIABLE | HID_IOF_ABSOLUTE | HID_IOF_NON_VOLATILE),
+	HID_RI_END_COLLECTION(0),
 };
+#endif
 
 /** Device descriptor structure. This descriptor, located in FLASH memory, describes the overall
  *  device characteristics, including the supported USB version, control endpoint size and the
  *  number of device configurations. The descriptor is read out by the USB host when the enumeration
- *  process begins.
+ *  process begins. Only configurations with the CDC interface association use the IAD class, so
+ *  each profile has its own.
  */
+#define DEVICE_DESCRIPTOR(ClassCode, SubClassCode, ProtocolCode) \
+  { \
+    .Header                 = {.Size = sizeof(USB_Descriptor_Device_t), .Type = DTYPE_Device}, \
+\
+    .USBSpecification       = VERSION_BCD(1,1,0), \
+    .Class                  = ClassCode, \
+    .SubClass               = SubClassCode, \
+    .Protocol               = ProtocolCode, \
+\
+    .Endpoint0Size          = FIXED_CONTROL_ENDPOINT_SIZE, \
+\
+    .VendorID               = 0x03EB, \
+    .ProductID              = 0x2062, \
+    .ReleaseNumber          = VERSION_BCD(0,0,1), \
+\
+    .ManufacturerStrIndex   = STRING_ID_Manufacturer, \
+    .ProductStrIndex        = STRING_ID_Product, \
+    .SerialNumStrIndex      = USE_INTERNAL_SERIAL, \
+\
+    .NumberOfConfigurations = FIXED_NUM_CONFIGURATIONS \
+  }
+
+#if USB_CDC
 const USB_Descriptor_Device_t PROGMEM DeviceDescriptor =
-{
-	.Header                 = {.Size = sizeof(USB_Descriptor_Device_t), .Type = DTYPE_Device},
-
-	.USBSpecification       = VERSION_BCD(1,1,0),
-
-	.Class                  = USB_CSCP_IADDeviceClass,
-	.SubClass               = USB_CSCP_IADDeviceSubclass,
-	.Protocol               = USB_CSCP_IADDeviceProtocol,
+	DEVICE_DESCRIPTOR(USB_CSCP_IADDeviceClass, USB_CSCP_IADDeviceSubclass, USB_CSCP_IADDeviceProtocol);
 
-	.Endpoint0Size          = FIXED_CONTROL_ENDPOINT_SIZE,
-
-	.VendorID               = 0x03EB,
-	.ProductID              = 0x2062,
-	.ReleaseNumber          = VERSION_BCD(0,0,1),
-
-	.ManufacturerStrIndex   = STRING_ID_Manufacturer,
-	.ProductStrIndex        = STRING_ID_Product,
-	.SerialNumStrIndex      = USE_INTERNAL_SERIAL,
-
-	.NumberOfConfigurations = FIXED_NUM_CONFIGURATIONS
-};
+/** Device descriptor of the tournament profile, which has no CDC interfaces. */
+const USB_Descriptor_Device_t PROGMEM TournamentDeviceDescriptor =
+	DEVICE_DESCRIPTOR(USB_CSCP_NoDeviceClass, USB_CSCP_NoDeviceSubclass, USB_CSCP_NoDeviceProtocol);
+#else
+const USB_Descriptor_Device_t PROGMEM DeviceDescriptor =
+	DEVICE_DESCRIPTOR(USB_CSCP_NoDeviceClass, USB_CSCP_NoDeviceSubclass, USB_CSCP_NoDeviceProtocol);
+#endif
+
+/** Input interface descriptors, shared by the configuration descriptor of every USB profile. */
+#if USB_SINGLE_HID
+#define INPUT_INTERFACE_DESCRIPTORS \
+  .HID1_InputInterface = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface}, \
+\
+      .InterfaceNumber        = INTERFACE_ID_Input, \
+      .AlternateSetting       = 0x00, \
+\
+      .TotalEndpoints         = 1, \
+\
+      .Class                  = HID_CSCP_HIDClass, \
+      .SubClass               = HID_CSCP_NonBootSubclass, \
+      .Protocol               = HID_CSCP_NonBootProtocol, \
+\
+      .InterfaceStrIndex      = NO_DESCRIPTOR \
+    }, \
+\
+  .HID1_InputHID = \
+    { \
+      .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID}, \
+\
+      .HIDSpec                = VERSION_BCD(1,1,1), \
+      .CountryCode            = 0x00, \
+      .TotalReportDescriptors = 1, \
+      .HIDReportType          = HID_DTYPE_Report, \
+      .HIDReportLength        = sizeof(InputReport) \
+    }, \
+\
+  .HID1_ReportINEndpoint = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint}, \
+\
+      .EndpointAddress        = INPUT_IN_EPADDR, \
+      .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA), \
+      .EndpointSize           = INPUT_EPSIZE, \
+      .PollingIntervalMS      = 0x01 \
+    }
+#else
+#define INPUT_INTERFACE_DESCRIPTORS \
+  .HID1_KeyboardInterface = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface}, \
+\
+      .InterfaceNumber        = INTERFACE_ID_Keyboard, \
+      .AlternateSetting       = 0x00, \
+\
+      .TotalEndpoints         = 1, \
+\
+      .Class                  = HID_CSCP_HIDClass, \
+      .SubClass               = HID_CSCP_BootSubclass, \
+      .Protocol               = HID_CSCP_KeyboardBootProtocol, \
+\
+      .InterfaceStrIndex      = NO_DESCRIPTOR \
+    }, \
+\
+  .HID1_KeyboardHID = \
+    { \
+      .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID}, \
+\
+      .HIDSpec                = VERSION_BCD(1,1,1), \
+      .CountryCode            = 0x00, \
+      .TotalReportDescriptors = 1, \
+      .HIDReportType          = HID_DTYPE_Report, \
+      .HIDReportLength        = sizeof(KeyboardReport) \
+    }, \
+\
+  .HID1_ReportINEndpoint = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint}, \
+\
+      .EndpointAddress        = KEYBOARD_IN_EPADDR, \
+      .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA), \
+      .EndpointSize           = KEYBOARD_EPSIZE, \
+      .PollingIntervalMS      = 0x01 \
+    }, \
+\
+  .HID2_MouseInterface = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface}, \
+\
+      .InterfaceNumber        = INTERFACE_ID_Mouse, \
+      .AlternateSetting       = 0x00, \
+\
+      .TotalEndpoints         = 1, \
+\
+      .Class                  = HID_CSCP_HIDClass, \
+      .SubClass               = HID_CSCP_NonBootSubclass, \
+      .Protocol               = HID_CSCP_NonBootProtocol, \
+\
+      .InterfaceStrIndex      = NO_DESCRIPTOR \
+    }, \
+\
+  .HID2_MouseHID = \
+    { \
+      .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID}, \
+\
+      .HIDSpec                = VERSION_BCD(1,1,1), \
+      .CountryCode            = 0x00, \
+      .TotalReportDescriptors = 1, \
+      .HIDReportType          = HID_DTYPE_Report, \
+      .HIDReportLength        = sizeof(MouseReport) \
+    }, \
+\
+  .HID2_ReportINEndpoint = \
+    { \
+      .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint}, \
+\
+      .EndpointAddress        = MOUSE_IN_EPADDR, \
+      .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA), \
+      .EndpointSize           = MOUSE_EPSIZE, \
+      .PollingIntervalMS      = 0x01 \
+    }
+#endif
 
 /** Configuration descriptor structure. This descriptor, located in FLASH memory, describes the usage
  *  of the device in one of its supported configurations, including information about any device interfaces
@@ -106,16 +405,22 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.Header                 = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
 
 			.TotalConfigurationSize = sizeof(USB_Descriptor_Configuration_t),
-			.TotalInterfaces        = 4,
+			.TotalInterfaces        = INTERFACE_COUNT,
 
 			.ConfigurationNumber    = 1,
 			.ConfigurationStrIndex  = NO_DESCRIPTOR,
 
-			.ConfigAttributes       = (USB_CONFIG_ATTR_RESERVED),
+			.ConfigAttributes       = (USB_CONFIG_ATTR_RESERVED | USB_CONFIG_ATTR_REMOTEWAKEUP),
 
 			.MaxPowerConsumption    = USB_CONFIG_POWER_MA(500)
 		},
 
+	.Inputs =
+		{
+			INPUT_INTERFACE_DESCRIPTORS
+		},
+
+#if USB_CDC
 	.CDC_IAD =
 		{
 			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_Association_t), .Type = DTYPE_InterfaceAssociation},
@@ -216,24 +521,26 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.EndpointSize           = CDC_TXRX_EPSIZE,
 			.PollingIntervalMS      = 0x10
 		},
+#endif
 
-  .HID1_KeyboardInterface =
+#if USB_RAW_HID
+  .HID3_RawInterface =
     {
       .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
 
-      .InterfaceNumber        = INTERFACE_ID_Keyboard,
+      .InterfaceNumber        = INTERFACE_ID_Raw,
       .AlternateSetting       = 0x00,
 
       .TotalEndpoints         = 1,
 
       .Class                  = HID_CSCP_HIDClass,
-      .SubClass               = HID_CSCP_BootSubclass,
-      .Protocol               = HID_CSCP_KeyboardBootProtocol,
+      .SubClass               = HID_CSCP_NonBootSubclass,
+      .Protocol               = HID_CSCP_NonBootProtocol,
 
       .InterfaceStrIndex      = NO_DESCRIPTOR
     },
 
-  .HID1_KeyboardHID =
+  .HID3_RawHID =
     {
       .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID},
 
@@ -241,56 +548,45 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
       .CountryCode            = 0x00,
       .TotalReportDescriptors = 1,
       .HIDReportType          = HID_DTYPE_Report,
-      .HIDReportLength        = sizeof(KeyboardReport)
+      .HIDReportLength        = sizeof(RawReport)
     },
 
-  .HID1_ReportINEndpoint =
+  .HID3_ReportINEndpoint =
     {
       .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
 
-      .EndpointAddress        = KEYBOARD_IN_EPADDR,
+      .EndpointAddress        = RAW_IN_EPADDR,
       .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-      .EndpointSize           = HID_EPSIZE,
+      .EndpointSize           = RAW_EPSIZE,
       .PollingIntervalMS      = 0x01
     },
+#endif
+};
 
-  .HID2_MouseInterface =
-    {
-      .Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
-
-      .InterfaceNumber        = INTERFACE_ID_Mouse,
-      .AlternateSetting       = 0x00,
-
-      .TotalEndpoints         = 1,
-
-      .Class                  = HID_CSCP_HIDClass,
-      .SubClass               = HID_CSCP_BootSubclass,
-      .Protocol               = HID_CSCP_MouseBootProtocol,
-
-      .InterfaceStrIndex      = NO_DESCRIPTOR
-    },
+/** Configuration descriptor of the tournament profile. It has the same input interfaces as the full
+ *  configuration, with the same interface numbers and endpoints, and nothing else.
+ */
+const USB_Descriptor_TournamentConfiguration_t PROGMEM TournamentConfigurationDescriptor =
+{
+	.Config =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
 
-  .HID2_MouseHID =
-    {
-      .Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID},
+			.TotalConfigurationSize = sizeof(USB_Descriptor_TournamentConfiguration_t),
+			.TotalInterfaces        = INTERFACE_COUNT_Tournament,
 
-      .HIDSpec                = VERSION_BCD(1,1,1),
-      .CountryCode            = 0x00,
-      .TotalReportDescriptors = 1,
-      .HIDReportType          = HID_DTYPE_Report,
-      .HIDReportLength        = sizeof(MouseReport)
-    },
+			.ConfigurationNumber    = 1,
+			.ConfigurationStrIndex  = NO_DESCRIPTOR,
 
-  .HID2_ReportINEndpoint =
-    {
-      .Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+			.ConfigAttributes       = (USB_CONFIG_ATTR_RESERVED | USB_CONFIG_ATTR_REMOTEWAKEUP),
 
-      .EndpointAddress        = MOUSE_IN_EPADDR,
-      .Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
-      .EndpointSize           = HID_EPSIZE,
-      .PollingIntervalMS      = 0x01
-    }
+			.MaxPowerConsumption    = USB_CONFIG_POWER_MA(500)
+		},
 
+	.Inputs =
+		{
+			INPUT_INTERFACE_DESCRIPTORS
+		},
 };
 
 /** Language descriptor structure. This descriptor, located in FLASH memory, is returned when the host requests
@@ -330,12 +626,25 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 	switch (DescriptorType)
 	{
 		case DTYPE_Device:
-			Address = &DeviceDescriptor;
+#if USB_CDC
+			if (USB_Profile == USB_PROFILE_Tournament)
+			  Address = &TournamentDeviceDescriptor;
+			else
+#endif
+			  Address = &DeviceDescriptor;
 			Size    = sizeof(USB_Descriptor_Device_t);
 			break;
 		case DTYPE_Configuration:
-			Address = &ConfigurationDescriptor;
-			Size    = sizeof(USB_Descriptor_Configuration_t);
+			if (USB_Profile == USB_PROFILE_Tournament)
+			{
+				Address = &TournamentConfigurationDescriptor;
+				Size    = sizeof(USB_Descriptor_TournamentConfiguration_t);
+			}
+			else
+			{
+				Address = &ConfigurationDescriptor;
+				Size    = sizeof(USB_Descriptor_Configuration_t);
+			}
 			break;
 		case DTYPE_String:
 			switch (DescriptorNumber)
@@ -358,20 +667,41 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 		case HID_DTYPE_HID:
 		  switch (wIndex)
 		  {
+#if USB_SINGLE_HID
+  		  case INTERFACE_ID_Input:
+  		  Address = &ConfigurationDescriptor.Inputs.HID1_InputHID;
+  		  Size    = sizeof(USB_HID_Descriptor_HID_t);
+  		  break;
+#else
   		  case INTERFACE_ID_Keyboard:
-  		  Address = &ConfigurationDescriptor.HID1_KeyboardHID;
+  		  Address = &ConfigurationDescriptor.Inputs.HID1_KeyboardHID;
   		  Size    = sizeof(USB_HID_Descriptor_HID_t);
   		  break;
   		  case INTERFACE_ID_Mouse:
-  		  Address = &ConfigurationDescriptor.HID2_MouseHID;
+  		  Address = &ConfigurationDescriptor.Inputs.HID2_MouseHID;
   		  Size    = sizeof(USB_HID_Descriptor_HID_t);
   		  break;
+#endif
+#if USB_RAW_HID
+  		  case INTERFACE_ID_Raw:
+  		  // The tournament profile has no raw interface, so the request is stalled
+  		  if (USB_Profile != USB_PROFILE_Full) break;
+  		  Address = &ConfigurationDescriptor.HID3_RawHID;
+  		  Size    = sizeof(USB_HID_Descriptor_HID_t);
+  		  break;
+#endif
 		  }
 
   		break;
 		case HID_DTYPE_Report:
 		  switch (wIndex)
 		  {
+#if USB_SINGLE_HID
+  		  case INTERFACE_ID_Input:
+  		  Address = &InputReport;
+  		  Size    = sizeof(InputReport);
+  		  break;
+#else
   		  case INTERFACE_ID_Keyboard:
   		  Address = &KeyboardReport;
   		  Size    = sizeof(KeyboardReport);
@@ -380,6 +710,14 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
   		  Address = &MouseReport;
   		  Size    = sizeof(MouseReport);
   		  break;
+#endif
+#if USB_RAW_HID
+  		  case INTERFACE_ID_Raw:
+  		  if (USB_Profile != USB_PROFILE_Full) break;
+  		  Address = &RawReport;
+  		  Size    = sizeof(RawReport);
+  		  break;
+#endif
 		  }
 
 		  break;
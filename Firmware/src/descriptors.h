@@ -42,6 +42,41 @@
 		#include <LUFA/Drivers/USB/USB.h>
 
 	/* Macros: */
+		/** Set to 1 to send the buttons and knobs together in one report on a single HID
+		 *  interface, instead of on separate keyboard and mouse interfaces. The report is a
+		 *  joystick collection with relative axes, which the operating system's keyboard, mouse
+		 *  and game controller drivers don't use, so it needs host software that reads it directly.
+		 */
+		#ifndef USB_COMPOSITE_HID
+		#define USB_COMPOSITE_HID 0
+		#endif
+
+		/** Set to 1 to send the buttons and the knob positions as a gamepad on a single HID
+		 *  interface, with absolute, wrapping 16-bit axes instead of relative mouse motion.
+		 */
+		#ifndef USB_JOYSTICK_HID
+		#define USB_JOYSTICK_HID 0
+		#endif
+
+		#if USB_COMPOSITE_HID && USB_JOYSTICK_HID
+		#error USB_COMPOSITE_HID and USB_JOYSTICK_HID are alternatives
+		#endif
+
+		/** Buttons and knobs share one HID interface. */
+		#define USB_SINGLE_HID            (USB_COMPOSITE_HID || USB_JOYSTICK_HID)
+
+		/** Set to 0 to drop the CDC serial console, which needs a driver on some hosts and three
+		 *  endpoints. Configuration and telemetry are still available over the raw HID interface.
+		 */
+		#ifndef USB_CDC
+		#define USB_CDC 1
+		#endif
+
+		/** Set to 0 to drop the vendor-defined raw HID interface for configuration and telemetry. */
+		#ifndef USB_RAW_HID
+		#define USB_RAW_HID 1
+		#endif
+
 		/** Endpoint address of the CDC device-to-host notification IN endpoint. */
 		#define CDC_NOTIFICATION_EPADDR        (ENDPOINT_DIR_IN  | 3)
 
@@ -66,8 +101,91 @@
     /** Size in bytes of each of the HID reporting IN endpoints. */
     #define HID_EPSIZE                8
 
+    /** Size in bytes of the Keyboard HID reporting IN endpoint, which carries the NKRO bitmap. The
+     *  interface still declares the boot keyboard protocol, whose endpoint is 8 bytes everywhere
+     *  else, so BIOS stacks that assume that size may not take the keyboard. A separate 8-byte boot
+     *  interface would need a seventh endpoint, and the ATmega32U4 has six, all in use.
+     */
+    #define KEYBOARD_EPSIZE           16
+
+    /** Number of key usages covered by the NKRO bitmap, starting from usage 0. */
+    #define KEYBOARD_BITMAP_KEYS      104
+
+    /** Size in bytes of the Mouse HID reporting IN endpoint, which also carries the knob timing. */
+    #define MOUSE_EPSIZE              16
+
+    /** Endpoint address of the combined HID reporting IN endpoint when USB_SINGLE_HID is set. */
+    #define INPUT_IN_EPADDR           (ENDPOINT_DIR_IN | 1)
+
+    /** Size in bytes of the combined HID reporting IN endpoint. */
+    #define INPUT_EPSIZE              16
+
+    /** Endpoint address of the raw HID telemetry IN endpoint. */
+    #define RAW_IN_EPADDR             (ENDPOINT_DIR_IN | 6)
+
+    /** Size in bytes of every raw HID report, input, output and feature alike. */
+    #define RAW_REPORT_SIZE           32
+
+    /** Size in bytes of the raw HID telemetry IN endpoint. */
+    #define RAW_EPSIZE                RAW_REPORT_SIZE
+
 
 	/* Type Defines: */
+		/** Type define for the N-key rollover keyboard report, matching KeyboardReport[]. */
+		typedef struct
+		{
+			uint8_t Modifier; /**< Modifier mask, bit n is usage 0xE0 + n */
+			uint8_t Keys[KEYBOARD_BITMAP_KEYS / 8]; /**< Key bitmap, bit n of byte i is usage 8 * i + n */
+		} ATTR_PACKED USB_NKROKeyboardReport_Data_t;
+
+		/** Type define for the knob report sent on the mouse interface. Unlike the standard
+		 *  USB_MouseReport_Data_t its axes are 16 bits wide, to match MouseReport[]. The combined
+		 *  report of USB_COMPOSITE_HID has the same layout with all seven buttons in Buttons.
+		 */
+		typedef struct
+		{
+			uint8_t Buttons; /**< Button mask, bit n is the button at ePinId BT_A + n */
+			int16_t X; /**< Left knob delta */
+			int16_t Y; /**< Right knob delta */
+			int16_t VelocityX; /**< Left knob speed in steps per second */
+			int16_t VelocityY; /**< Right knob speed in steps per second */
+			uint16_t AgeX; /**< Microseconds since the last left knob step */
+			uint16_t AgeY; /**< Microseconds since the last right knob step */
+		} ATTR_PACKED USB_KnobReport_Data_t;
+
+		/** Type define for the gamepad report of USB_JOYSTICK_HID, matching JoystickReport[]. The
+		 *  axes are knob positions in encoder steps, and wrap around from 65535 to 0.
+		 */
+		typedef struct
+		{
+			uint8_t Buttons; /**< Button mask, bit n is the button at ePinId BT_A + n */
+			uint16_t X; /**< Left knob position */
+			uint16_t Y; /**< Right knob position */
+		} ATTR_PACKED USB_JoystickReport_Data_t;
+
+		/** Type define for the descriptors of the input interfaces. They come first in the configuration
+		 *  descriptor of every USB profile, so they keep their interface numbers in all of them.
+		 */
+		typedef struct
+		{
+#if USB_SINGLE_HID
+			// Combined Buttons and Knobs HID Interface
+			USB_Descriptor_Interface_t               HID1_InputInterface;
+			USB_HID_Descriptor_HID_t                 HID1_InputHID;
+			USB_Descriptor_Endpoint_t                HID1_ReportINEndpoint;
+#else
+			// Keyboard HID Interface
+			USB_Descriptor_Interface_t               HID1_KeyboardInterface;
+			USB_HID_Descriptor_HID_t                 HID1_KeyboardHID;
+			USB_Descriptor_Endpoint_t                HID1_ReportINEndpoint;
+
+			// Mouse HID Interface
+			USB_Descriptor_Interface_t               HID2_MouseInterface;
+			USB_HID_Descriptor_HID_t                 HID2_MouseHID;
+			USB_Descriptor_Endpoint_t                HID2_ReportINEndpoint;
+#endif
+		} USB_Descriptor_Inputs_t;
+
 		/** Type define for the device configuration descriptor structure. This must be defined in the
 		 *  application code, as the configuration descriptor contains several sub-descriptors which
 		 *  vary between devices, and which describe the device's usage to the host.
@@ -75,7 +193,9 @@
 		typedef struct
 		{
 			USB_Descriptor_Configuration_Header_t    Config;
+			USB_Descriptor_Inputs_t                  Inputs;
 
+#if USB_CDC
 			// CDC Control Interface
 			USB_Descriptor_Interface_Association_t   CDC_IAD;
 			USB_Descriptor_Interface_t               CDC_CCI_Interface;
@@ -88,28 +208,62 @@
 			USB_Descriptor_Interface_t               CDC_DCI_Interface;
 			USB_Descriptor_Endpoint_t                CDC_DataOutEndpoint;
 			USB_Descriptor_Endpoint_t                CDC_DataInEndpoint;
+#endif
 
-			// Keyboard HID Interface
-			USB_Descriptor_Interface_t               HID1_KeyboardInterface;
-			USB_HID_Descriptor_HID_t                 HID1_KeyboardHID;
-			USB_Descriptor_Endpoint_t                HID1_ReportINEndpoint;
-
-			// Mouse HID Interface
-			USB_Descriptor_Interface_t               HID2_MouseInterface;
-			USB_HID_Descriptor_HID_t                 HID2_MouseHID;
-			USB_Descriptor_Endpoint_t                HID2_ReportINEndpoint;
+#if USB_RAW_HID
+			// Raw Configuration and Telemetry HID Interface
+			USB_Descriptor_Interface_t               HID3_RawInterface;
+			USB_HID_Descriptor_HID_t                 HID3_RawHID;
+			USB_Descriptor_Endpoint_t                HID3_ReportINEndpoint;
+#endif
 		} USB_Descriptor_Configuration_t;
 
+		/** Type define for the configuration descriptor of the tournament profile, which exposes only the
+		 *  input interfaces.
+		 */
+		typedef struct
+		{
+			USB_Descriptor_Configuration_Header_t    Config;
+			USB_Descriptor_Inputs_t                  Inputs;
+		} USB_Descriptor_TournamentConfiguration_t;
+
 		/** Enum for the device interface descriptor IDs within the device. Each interface descriptor
 		 *  should have a unique ID index associated with it, which can be used to refer to the
 		 *  interface from other descriptors.
 		 */
 		enum InterfaceDescriptors_t
 		{
-			INTERFACE_ID_CDC_CCI  = 0, /**< CDC CCI interface descriptor ID */
-			INTERFACE_ID_CDC_DCI  = 1, /**< CDC DCI interface descriptor ID */
-      INTERFACE_ID_Keyboard = 2, /**< Keyboard interface descriptor ID */
-			INTERFACE_ID_Mouse    = 3, /**< Mouse interface descriptor ID */
+#if USB_SINGLE_HID
+			INTERFACE_ID_Input, /**< Combined buttons and knobs interface descriptor ID */
+#else
+			INTERFACE_ID_Keyboard, /**< Keyboard interface descriptor ID */
+			INTERFACE_ID_Mouse, /**< Mouse interface descriptor ID */
+#endif
+#if USB_CDC
+			INTERFACE_ID_CDC_CCI, /**< CDC CCI interface descriptor ID */
+			INTERFACE_ID_CDC_DCI, /**< CDC DCI interface descriptor ID */
+#endif
+#if USB_RAW_HID
+			INTERFACE_ID_Raw, /**< Raw configuration and telemetry interface descriptor ID */
+#endif
+			INTERFACE_COUNT /**< Number of interfaces in the configuration */
+		};
+
+		/** Number of interfaces in the tournament profile, which stops after the input interfaces. */
+#if USB_SINGLE_HID
+		#define INTERFACE_COUNT_Tournament (INTERFACE_ID_Input + 1)
+#else
+		#define INTERFACE_COUNT_Tournament (INTERFACE_ID_Mouse + 1)
+#endif
+
+		/** Enum for the USB profiles, one of which is picked at plug-in to choose the configuration
+		 *  descriptor and the interfaces the main loop services.
+		 */
+		enum USB_Profiles_t
+		{
+			USB_PROFILE_Full, /**< Every interface of the build */
+			USB_PROFILE_Tournament, /**< Input interfaces only, for the smallest loop and the quickest enumeration */
+			USB_PROFILE_COUNT /**< Number of profiles */
 		};
 
 		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
@@ -124,6 +278,10 @@
 		};
 
 
+	/* External Variables: */
+		/** USB_Profiles_t picked at plug-in, before USB_Init(). */
+		extern uint8_t USB_Profile;
+
 	/* Function Prototypes: */
 		uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 		                                    const uint16_t wIndex,
@@ -1,59 +1,331 @@
 #include "encoder.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "debounce.h"
+#include "reports.h"
+#include "settings.h"
+#include "timebase.h"
 
-static uint8_t old_AB_left = 0;
-static uint8_t old_AB_right = 0;
-static const int8_t enc_states[] = {0,-1,1,0,1,0,0,-1,-1,0,0,1,0,1,-1,0};
-static int8_t delta_left = 0;
-static int8_t delta_right = 0;
+/* Packs both knobs from a PORTB value into one nibble: bits 1:0 hold the left
+ * knob's A:B (PB4:PB5), bits 3:2 the right knob's A:B (PB0:PB7) */
+#define ENC_NIBBLE(pinb) ((((pinb) >> 3) & 0x02) | (((pinb) >> 5) & 0x05) | (((pinb) << 3) & 0x08))
+
+/* Transition code for a 4-bit (old A:B, new A:B) index: +1 or -1 for a step, 0 when idle,
+ * ENC_ILLEGAL when both lines changed at once. The steps are the same as the old
+ * enc_states[] = {0,-1,1,0,1,0,0,-1,-1,0,0,1,0,1,-1,0}, which dropped illegal transitions */
+#define ENC_ILLEGAL 2
+#define ENC_CODE(i) ((int8_t) (((0x2814 >> (i)) & 1) - ((0x4182 >> (i)) & 1) + \
+                               ENC_ILLEGAL * ((0x1248 >> (i)) & 1)))
+
+/* Table entry for a previous and current nibble: left code in the low nibble,
+ * right code in the high nibble, both as 4-bit two's complement */
+#define ENC_ENTRY(p, c) ((uint8_t) ((ENC_CODE((((p) & 0x03) << 2) | ((c) & 0x03)) & 0x0f) | \
+                                    ((ENC_CODE(((p) & 0x0c) | (((c) >> 2) & 0x03)) & 0x0f) << 4)))
+#define ENC_ROW(p) \
+  ENC_ENTRY(p, 0x0), ENC_ENTRY(p, 0x1), ENC_ENTRY(p, 0x2), ENC_ENTRY(p, 0x3), \
+  ENC_ENTRY(p, 0x4), ENC_ENTRY(p, 0x5), ENC_ENTRY(p, 0x6), ENC_ENTRY(p, 0x7), \
+  ENC_ENTRY(p, 0x8), ENC_ENTRY(p, 0x9), ENC_ENTRY(p, 0xa), ENC_ENTRY(p, 0xb), \
+  ENC_ENTRY(p, 0xc), ENC_ENTRY(p, 0xd), ENC_ENTRY(p, 0xe), ENC_ENTRY(p, 0xf)
+
+/* Both knobs are decoded with a single lookup keyed on (previous nibble << 4) | current nibble */
+static const uint8_t enc_table[256] PROGMEM =
+{
+  ENC_ROW(0x0), ENC_ROW(0x1), ENC_ROW(0x2), ENC_ROW(0x3),
+  ENC_ROW(0x4), ENC_ROW(0x5), ENC_ROW(0x6), ENC_ROW(0x7),
+  ENC_ROW(0x8), ENC_ROW(0x9), ENC_ROW(0xa), ENC_ROW(0xb),
+  ENC_ROW(0xc), ENC_ROW(0xd), ENC_ROW(0xe), ENC_ROW(0xf),
+};
+
+/* 8000000 / m for m = 128..255. A period normalized to m << e then gives
+ * 1000000 / period = table[m - 128] >> (e + 3), without a 32-bit division */
+#define ENC_RECIP(m) ((uint16_t) ((8000000UL + (m) / 2) / (m)))
+#define ENC_RECIP_ROW(m) \
+  ENC_RECIP((m) + 0), ENC_RECIP((m) + 1), ENC_RECIP((m) + 2), ENC_RECIP((m) + 3), \
+  ENC_RECIP((m) + 4), ENC_RECIP((m) + 5), ENC_RECIP((m) + 6), ENC_RECIP((m) + 7)
+
+static const uint16_t enc_recip[128] PROGMEM =
+{
+  ENC_RECIP_ROW(128), ENC_RECIP_ROW(136), ENC_RECIP_ROW(144), ENC_RECIP_ROW(152),
+  ENC_RECIP_ROW(160), ENC_RECIP_ROW(168), ENC_RECIP_ROW(176), ENC_RECIP_ROW(184),
+  ENC_RECIP_ROW(192), ENC_RECIP_ROW(200), ENC_RECIP_ROW(208), ENC_RECIP_ROW(216),
+  ENC_RECIP_ROW(224), ENC_RECIP_ROW(232), ENC_RECIP_ROW(240), ENC_RECIP_ROW(248),
+};
+
+typedef struct
+{
+  int16_t delta;
+  uint16_t position; /* steps since power up, wrapping */
+  int8_t dir; /* direction of the last step, 0 before the first */
+  uint32_t last_us; /* time of the last step */
+  uint32_t period_us; /* time between the last two steps in the same direction */
+  int8_t pending; /* reversal held back by the deadband, 0 when none */
+  uint16_t illegal;
+  uint16_t jitter;
+} sKnob;
+
+static uint8_t old_nibble = 0;
+static volatile sKnob knobs[NUM_KNOBS];
+
+/* Raw steps moved out of the interrupt's reach by EncoderLatch() and not yet scaled */
+static int16_t latched[NUM_KNOBS];
+
+/* Scaled motion not yet reported, in 1/256 report counts */
+static int32_t remainder[NUM_KNOBS];
 
 void EncoderInit(void)
 {
   DDRB = 0x0;
+
+#if ENCODER_USE_PCINT
+  /* Start decoding from the current position of both knobs */
+  old_nibble = ENC_NIBBLE(PINB);
+
+  /* Interrupt on every edge of the encoder pins */
+  PCMSK0 |= (1 << PCINT4) | (1 << PCINT5) | (1 << PCINT0) | (1 << PCINT7);
+  PCIFR = (1 << PCIF0);
+  PCICR |= (1 << PCIE0);
+#endif
+}
+
+/* Adds one step without wrapping around, however far the host falls behind */
+static inline void EncoderAccumulate(volatile int16_t *delta, int8_t step)
+{
+  int16_t d = *delta;
+  if ((step > 0 && d < INT16_MAX) || (step < 0 && d > INT16_MIN)) {
+    *delta = d + step;
+  }
+}
+
+static inline void EncoderStep(volatile sKnob *knob, int8_t step, uint32_t now)
+{
+  EncoderAccumulate(&knob->delta, step);
+  knob->position += step;
+
+  /* A reversal starts a new estimate instead of averaging across it */
+  knob->period_us = (step == knob->dir) ? now - knob->last_us : ENCODER_STOP_US;
+  knob->dir = step;
+  knob->last_us = now;
+}
+
+static inline void EncoderCount(volatile uint16_t *counter)
+{
+  if (*counter < UINT16_MAX) (*counter)++;
+}
+
+/* With the deadband on, a step against the current direction is held back until the
+ * next transition. Another step the same way confirms the reversal and both are
+ * counted. A step back cancels it as jitter, which is what a knob resting on a detent
+ * edge produces. Steps in the current direction are never delayed. */
+static inline bool EncoderTransition(volatile sKnob *knob, int8_t code, uint32_t now)
+{
+  if (code == ENC_ILLEGAL) {
+    EncoderCount(&knob->illegal);
+    return false;
+  }
+
+#if ENCODER_DEADBAND
+  int8_t pending = knob->pending;
+  if (pending) {
+    knob->pending = 0;
+    if (code != pending) {
+      EncoderCount(&knob->jitter);
+      return false;
+    }
+    EncoderStep(knob, pending, now);
+  } else if (knob->dir && code != knob->dir) {
+    knob->pending = code;
+    return false;
+  }
+#endif
+
+  EncoderStep(knob, code, now);
+  return true;
+}
+
+/* Returns true if either knob moved */
+static inline bool EncoderDecode(uint8_t pinb)
+{
+  bool moved = false;
+
+  uint8_t nibble = ENC_NIBBLE(pinb);
+  uint8_t entry = pgm_read_byte(&enc_table[(old_nibble << 4) | nibble]);
+  old_nibble = nibble;
+
+  if (entry) {
+    /* One timestamp per transition, shared by both knobs */
+    uint32_t now = TimebaseMicros();
+    int8_t code;
+
+    code = (int8_t) (entry << 4) >> 4;
+    if (code) moved |= EncoderTransition(&knobs[KNOB_LEFT], code, now);
+    code = (int8_t) entry >> 4;
+    if (code) moved |= EncoderTransition(&knobs[KNOB_RIGHT], code, now);
+  }
+
+  return moved;
+}
+
+#if ENCODER_USE_PCINT
+
+/* Runs on every transition of either knob, straight from the raw pins, so fast
+ * spins are not limited by the sample rate. The encoders have hardware debounce,
+ * and the table ignores transitions where both lines of a knob changed at once. */
+ISR(PCINT0_vect)
+{
+  if (EncoderDecode(PINB)) ReportsStageKnobs();
 }
-  
+
+#else
+
+/* Called from the sample interrupt */
 void EncoderUpdate(void)
 {
-  bool new_A_left = DebounceGetLevel(ENC_LEFT_A);
-  bool new_B_left = DebounceGetLevel(ENC_LEFT_B);
-  bool new_A_right = DebounceGetLevel(ENC_RIGHT_A);
-  bool new_B_right = DebounceGetLevel(ENC_RIGHT_B);
+  if (EncoderDecode(DebounceGetPort(PORT_B))) ReportsStageKnobs();
+}
+
+#endif
+
+/* Steps per second for a step period, saturating at INT16_MAX. Reports are built in interrupts,
+ * where a 32-bit division (about 40 us) per knob would hold off the sample tick, so this uses
+ * the reciprocal table. The period is truncated to 8 significant bits, which reads up to 1%
+ * fast, or one step per second at the slowest speeds. */
+static uint16_t EncoderSpeed(uint32_t period_us)
+{
+  uint8_t shift = 3;
+
+  if (period_us <= 1000000UL / INT16_MAX) return INT16_MAX;
 
-  old_AB_left <<= 2;
-  old_AB_left |= (uint8_t) ( (new_A_left << 1) | new_B_left );
-  
-  old_AB_right <<= 2;
-  old_AB_right |= (uint8_t) ( (new_A_right << 1) | new_B_right );
-  
-  if (delta_left > -126 && delta_left < 127) {
-    delta_left += enc_states[( old_AB_left & 0x0f )];
-  }    
-  if (delta_right > -126 && delta_right < 127) {
-    delta_right += enc_states[( old_AB_right & 0x0f )];
-  }    
+  while (period_us < 128) {
+    period_us <<= 1;
+    shift--;
+  }
+  while (period_us > 255) {
+    period_us >>= 1;
+    shift++;
+  }
+  return pgm_read_word(&enc_recip[period_us - 128]) >> shift;
 }
 
-int8_t EncoderGetLeftDelta(void)
+/* Estimates the speed from the last step period. Until the next step arrives the knob
+ * is at least as slow as the time since the last one, so the estimate decays smoothly
+ * to zero when the knob stops instead of holding the last speed. */
+void EncoderGetMotion(eKnobId knob, sEncoderMotion *motion)
 {
-  return delta_left;
+  volatile sKnob *k = &knobs[knob];
+  uint32_t last_us, period_us, age_us;
+  int8_t dir;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    last_us = k->last_us;
+    period_us = k->period_us;
+    dir = k->dir;
+  }
+
+  age_us = TimebaseMicros() - last_us;
+  if (age_us > period_us) period_us = age_us;
+  if (period_us == 0) period_us = 1;
+
+  motion->age_us = (age_us > ENCODER_AGE_MAX_US) ? ENCODER_AGE_MAX_US : age_us;
+
+  if (dir == 0 || period_us >= ENCODER_STOP_US) {
+    motion->velocity = 0;
+  } else {
+    uint16_t speed = EncoderSpeed(period_us);
+    motion->velocity = (dir > 0) ? (int16_t) speed : -(int16_t) speed;
+  }
 }
 
-void EncoderResetLeftDelta(void)
+void EncoderGetStats(eKnobId knob, sEncoderStats *stats)
 {
-  delta_left = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    stats->illegal = knobs[knob].illegal;
+    stats->jitter = knobs[knob].jitter;
+  }
 }
 
-int8_t EncoderGetRightDelta(void)
+/* Absolute knob position in steps, wrapping from 65535 to 0. Unlike the deltas it is not
+ * consumed by reading, and gain and acceleration don't apply to it. */
+uint16_t EncoderGetPosition(eKnobId knob)
 {
-  return delta_right;
+  uint16_t position;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    position = knobs[knob].position;
+  }
+  return position;
 }
 
-void EncoderResetRightDelta(void)
+void EncoderResetStats(void)
 {
-  delta_right = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+      knobs[k].illegal = 0;
+      knobs[k].jitter = 0;
+    }
+  }
+}
+
+/* Q8.8 report counts per step: the knob's gain times the multiplier for its speed band */
+static uint16_t EncoderScale(eKnobId knob, int16_t velocity)
+{
+  uint16_t speed = (velocity < 0) ? -velocity : velocity;
+  uint8_t band = 0;
+
+  for (speed >>= ENCODER_ACCEL_FIRST_SHIFT; speed && band < ENCODER_ACCEL_BANDS - 1; speed >>= 1) {
+    band++;
+  }
+
+  uint32_t scale = ((uint32_t) settings.knob_gain[knob] * settings.knob_accel[band]) >> 4;
+  return (scale > UINT16_MAX) ? UINT16_MAX : scale;
+}
+
+/* Moves the steps of both knobs so far into the latch in one go, so a report can be
+ * built from a single instant. Returns that instant in TimebaseMicros() time. */
+uint32_t EncoderLatch(void)
+{
+  uint32_t now;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    now = TimebaseMicros();
+    for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+      int32_t raw = (int32_t) latched[k] + knobs[k].delta;
+      if (raw > ENCODER_RAW_MAX) raw = ENCODER_RAW_MAX;
+      if (raw < -ENCODER_RAW_MAX) raw = -ENCODER_RAW_MAX;
+      knobs[k].delta -= raw - latched[k];
+      latched[k] = raw;
+    }
+  }
+
+  return now;
+}
+
+/* Scales the latched steps and hands out as many whole counts as fit in a report.
+ * The fraction and anything past ENCODER_DELTA_MAX carry over to the next one. Takes the
+ * motion the report carries, so the speed band matches the velocity the host sees. */
+int16_t EncoderTakeDelta(eKnobId knob, const sEncoderMotion *motion)
+{
+  int32_t scaled;
+  int16_t raw = latched[knob], taken;
+
+  latched[knob] = 0;
+
+  scaled = remainder[knob] + (int32_t) raw * EncoderScale(knob, motion->velocity);
+
+  /* Rounds toward zero so small moves behave the same in both directions */
+  taken = (scaled / 256 > ENCODER_DELTA_MAX) ? ENCODER_DELTA_MAX :
+          (scaled / 256 < -ENCODER_DELTA_MAX) ? -ENCODER_DELTA_MAX : scaled / 256;
+  scaled -= (int32_t) taken * 256;
+
+  /* Only reachable with a huge gain while the host isn't polling */
+  if (scaled > (1L << 30)) scaled = 1L << 30;
+  if (scaled < -(1L << 30)) scaled = -(1L << 30);
+  remainder[knob] = scaled;
+
+  return taken;
 }
\ No newline at end of file
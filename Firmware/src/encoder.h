@@ -4,11 +4,67 @@
 #include "encoder.h"
 #include <stdint.h>
 
+/* Decode the encoders from the PORTB pin change interrupt on every transition,
+ * rather than from the debounced levels at each sample tick */
+#ifndef ENCODER_USE_PCINT
+#define ENCODER_USE_PCINT 1
+#endif
+
+/* Hold back single reversals until the next transition so a knob flickering on a
+ * detent edge doesn't send back-and-forth deltas */
+#ifndef ENCODER_DEADBAND
+#define ENCODER_DEADBAND 1
+#endif
+
+/* Largest delta handed out per report; anything beyond it carries over to the next one */
+#define ENCODER_DELTA_MAX INT16_MAX
+
+/* Raw steps latched per report, which keeps the Q8 product within 32 bits */
+#define ENCODER_RAW_MAX 8191
+
+/* Gain is Q8.8 report counts per step */
+#define ENCODER_GAIN_UNITY 256
+
+/* The acceleration table has one Q4.4 multiplier per speed band. Band 0 covers speeds
+ * below 2^ENCODER_ACCEL_FIRST_SHIFT steps per second, and each band after it covers
+ * speeds up to twice as fast. The last band covers everything faster. A table of all
+ * ENCODER_ACCEL_UNITY turns acceleration off. */
+#define ENCODER_ACCEL_BANDS 8
+#define ENCODER_ACCEL_FIRST_SHIFT 7
+#define ENCODER_ACCEL_UNITY 16
+
+/* A knob with no step for this long is reported as stopped */
+#define ENCODER_STOP_US 100000UL
+
+/* Time since the last step saturates here in the report */
+#define ENCODER_AGE_MAX_US 32767
+
+typedef enum
+{
+  KNOB_LEFT,
+  KNOB_RIGHT,
+  NUM_KNOBS
+} eKnobId;
+
+typedef struct
+{
+  int16_t velocity; /* steps per second, signed like the delta */
+  uint16_t age_us; /* time since the last step */
+} sEncoderMotion;
+
+typedef struct
+{
+  uint16_t illegal; /* transitions where both lines changed at once */
+  uint16_t jitter; /* reversals cancelled by the deadband */
+} sEncoderStats;
+
 void EncoderInit(void);
 void EncoderUpdate(void);
-int8_t EncoderGetLeftDelta(void);
-void EncoderResetLeftDelta(void);
-int8_t EncoderGetRightDelta(void);
-void EncoderResetRightDelta(void);
+uint32_t EncoderLatch(void);
+int16_t EncoderTakeDelta(eKnobId knob, const sEncoderMotion *motion);
+void EncoderGetMotion(eKnobId knob, sEncoderMotion *motion);
+void EncoderGetStats(eKnobId knob, sEncoderStats *stats);
+void EncoderResetStats(void);
+uint16_t EncoderGetPosition(eKnobId knob);
 
 #endif /* ENCODER_H_ */
\ No newline at end of file
@@ -0,0 +1,49 @@
+#include "events.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Single producer ring: only interrupt handlers push, and they do not nest.
+ * Readers never block the producer; they detect overwritten entries instead. */
+
+#define EVENTS_QUEUE_MASK (EVENTS_QUEUE_SIZE - 1)
+
+static sInputEvent queue[EVENTS_QUEUE_SIZE];
+static volatile uint8_t head = 0; // Events pushed so far, modulo 256
+
+void EventsPush(ePinId pin, bool level, uint32_t time_us)
+{
+  sInputEvent *event = &queue[head & EVENTS_QUEUE_MASK];
+  event->pin = pin;
+  event->level = level;
+  event->time_us = time_us;
+  head++;
+}
+
+void EventsReaderInit(sEventReader *reader)
+{
+  reader->tail = head;
+  reader->overrun = false;
+}
+
+bool EventsPeek(sEventReader *reader, sInputEvent *event)
+{
+  while (1) {
+    uint8_t h = head;
+    if (h == reader->tail) return false;
+
+    if ((uint8_t) (h - reader->tail) > EVENTS_QUEUE_SIZE) {
+      reader->tail = h - EVENTS_QUEUE_SIZE;
+      reader->overrun = true;
+    }
+
+    *event = queue[reader->tail & EVENTS_QUEUE_MASK];
+
+    // The copy is only valid if the producer did not lap us while we made it
+    if ((uint8_t) (head - reader->tail) <= EVENTS_QUEUE_SIZE) return true;
+  }
+}
+
+void EventsConsume(sEventReader *reader)
+{
+  reader->tail++;
+}
\ No newline at end of file
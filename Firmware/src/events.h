@@ -0,0 +1,32 @@
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include "events.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+
+/* Must be a power of two no larger than 128 */
+#define EVENTS_QUEUE_SIZE 32
+
+typedef struct {
+  uint8_t pin;        // ePinId
+  bool level;         // New debounced level
+  uint32_t time_us;   // TimebaseMicros() when the edge was registered
+} sInputEvent;
+
+/* Every consumer owns a reader, so each one sees every event in order. If a
+ * reader falls more than EVENTS_QUEUE_SIZE events behind, the oldest events are
+ * skipped and overrun is set; the consumer should then resync from the levels. */
+typedef struct {
+  uint8_t tail;
+  bool overrun;
+} sEventReader;
+
+void EventsPush(ePinId pin, bool level, uint32_t time_us);
+void EventsReaderInit(sEventReader *reader);
+bool EventsPeek(sEventReader *reader, sInputEvent *event);
+void EventsConsume(sEventReader *reader);
+
+#endif /* EVENTS_H_ */
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "health.h"
+#include <util/atomic.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "settings.h"
+#include "timebase.h"
+
+/* A burst ends once the raw input has been quiet for longer than any trigger count can cover */
+#define HEALTH_SETTLE_TICKS          (DEBOUNCE_TRIGGER_COUNT_MAX + 1)
+#define HEALTH_CHATTER_US            15000
+#define HEALTH_CHATTER_TICKS         ((uint16_t) ((uint32_t) HEALTH_CHATTER_US * DEBOUNCE_SAMPLE_RATE_HZ / 1000000))
+#define HEALTH_CALIBRATION_BURSTS    16 // Bursts per calibration window
+#define HEALTH_CALIBRATION_MARGIN    1  // Ticks added on top of the longest run seen
+#define HEALTH_CALIBRATION_CLEAN     4  // Clean windows in a row before a count drops by one tick
+#define HEALTH_SAVE_DELAY_US         600000000UL // Calibrated counts are saved at most every 10 minutes
+#define HEALTH_NO_PIN                0xff
+#define HEALTH_NO_TRIGGER_COUNT      0xff
+
+typedef struct {
+  uint16_t first_edge;    // Tick of the first raw edge of the current burst
+  uint16_t last_edge;     // Tick of the latest raw edge
+  uint16_t last_change;   // Tick of the latest debounced change
+  uint8_t edges;          // Raw edges in the current burst
+  uint8_t longest_run;    // Longest stable run in the current burst
+  uint8_t window_bursts;  // Bursts in the current calibration window
+  uint8_t window_run;     // Longest stable run in the current calibration window
+  uint8_t clean_windows;  // Windows in a row that needed less than the current trigger count
+  uint8_t trigger_count;  // Calibrated trigger count waiting to be applied
+} sBurstTracker;
+
+static sSwitchHealth health[HEALTH_NUM_PINS];
+static sBurstTracker trackers[HEALTH_NUM_PINS];
+
+static uint8_t port_masks[NUM_PORTS];
+static uint8_t port_active[NUM_PORTS];
+static uint8_t bit_pins[NUM_PORTS][8];
+
+static volatile bool calibration_pending = false;
+#if HEALTH_AUTO_CALIBRATE
+static bool save_pending = false;
+static uint32_t save_from;   // TimebaseMicros() at the first change not yet saved
+#endif
+
+void HealthInit(void)
+{
+  memset(bit_pins, HEALTH_NO_PIN, sizeof(bit_pins));
+  for (ePinId p = HEALTH_FIRST_PIN; p < NUM_PINS; p++) {
+    ePortId port = DebounceGetPinPort(p);
+    uint8_t mask = DebounceGetPinMask(p);
+    port_masks[port] |= mask;
+    for (uint8_t b = 0; b < 8; b++) {
+      if (mask & (1 << b)) bit_pins[port][b] = p - HEALTH_FIRST_PIN;
+    }
+    trackers[p - HEALTH_FIRST_PIN].last_change = -HEALTH_CHATTER_TICKS;
+    trackers[p - HEALTH_FIRST_PIN].trigger_count = HEALTH_NO_TRIGGER_COUNT;
+  }
+}
+
+static void HealthEndBurst(uint8_t i)
+{
+  sSwitchHealth *h = &health[i];
+  sBurstTracker *t = &trackers[i];
+
+  uint16_t duration = t->last_edge - t->first_edge;
+  uint8_t bucket = 0;
+  while (duration && bucket < HEALTH_BOUNCE_BUCKETS - 1) {
+    duration >>= 1;
+    bucket++;
+  }
+  h->bounce_hist[bucket]++;
+  h->bursts++;
+  h->edges += t->edges;
+  if (t->edges > h->max_edges) h->max_edges = t->edges;
+  if (t->longest_run > h->max_run) h->max_run = t->longest_run;
+
+  /* The lowest safe trigger count must outlast every stable run inside a burst. A burst that
+   * needs more raises the count at once. The count only drops one tick at a time, after
+   * HEALTH_CALIBRATION_CLEAN windows in a row that all needed less, so one quiet window can't
+   * bring the chatter of a bouncy switch back. */
+  uint8_t current = settings.trigger_count[HEALTH_FIRST_PIN + i];
+  uint8_t needed = t->longest_run + HEALTH_CALIBRATION_MARGIN;
+  if (needed > DEBOUNCE_TRIGGER_COUNT_MAX) needed = DEBOUNCE_TRIGGER_COUNT_MAX;
+
+  if (needed > current) {
+    t->trigger_count = needed;
+    t->window_bursts = 0;
+    t->window_run = 0;
+    t->clean_windows = 0;
+    calibration_pending = true;
+    return;
+  }
+
+  if (t->longest_run > t->window_run) t->window_run = t->longest_run;
+  if (++t->window_bursts >= HEALTH_CALIBRATION_BURSTS) {
+    if (t->window_run + HEALTH_CALIBRATION_MARGIN >= current) {
+      t->clean_windows = 0;
+    } else if (++t->clean_windows >= HEALTH_CALIBRATION_CLEAN) {
+      t->clean_windows = 0;
+      if (t->trigger_count == HEALTH_NO_TRIGGER_COUNT) {
+        t->trigger_count = current - 1;
+        calibration_pending = true;
+      }
+    }
+    t->window_bursts = 0;
+    t->window_run = 0;
+  }
+}
+
+/* Called from the sample interrupt with the raw edges and debounced changes of one port */
+void HealthSample(ePortId port, uint8_t raw_edges, uint8_t level_changes, uint8_t level, uint16_t now)
+{
+  uint8_t work = (raw_edges | level_changes | port_active[port]) & port_masks[port];
+  if (!work) return;
+
+  for (uint8_t b = 0; b < 8; b++) {
+    uint8_t bit = 1 << b;
+    if (!(work & bit)) continue;
+
+    uint8_t i = bit_pins[port][b];
+    sSwitchHealth *h = &health[i];
+    sBurstTracker *t = &trackers[i];
+
+    if (raw_edges & bit) {
+      if (port_active[port] & bit) {
+        uint16_t run = now - t->last_edge;
+        if (run > t->longest_run) t->longest_run = run > 0xff ? 0xff : run;
+      } else {
+        port_active[port] |= bit;
+        t->first_edge = now;
+        t->edges = 0;
+        t->longest_run = 0;
+      }
+      if (t->edges < 0xff) t->edges++;
+      t->last_edge = now;
+    } else if ((port_active[port] & bit) && (uint16_t) (now - t->last_edge) >= HEALTH_SETTLE_TICKS) {
+      port_active[port] &= ~bit;
+      HealthEndBurst(i);
+    }
+
+    if (level_changes & bit) {
+      if (!(level & bit)) h->presses++;
+      if ((uint16_t) (now - t->last_change) < HEALTH_CHATTER_TICKS) h->chatter++;
+      t->last_change = now;
+    }
+  }
+}
+
+/* Applies calibrated trigger counts outside of the sample interrupt. They take effect at once,
+ * but are saved to EEPROM at most once every HEALTH_SAVE_DELAY_US, so a count that moves back
+ * and forth doesn't keep rewriting it. Only a count that differs from EEPROM by then is
+ * written. */
+void HealthUpdate(void)
+{
+#if HEALTH_AUTO_CALIBRATE
+  if (save_pending && TimebaseMicros() - save_from >= HEALTH_SAVE_DELAY_US) {
+    save_pending = false;
+    SettingsSave();
+  }
+
+  if (!calibration_pending) return;
+  calibration_pending = false;
+
+  for (uint8_t i = 0; i < HEALTH_NUM_PINS; i++) {
+    uint8_t trigger_count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      trigger_count = trackers[i].trigger_count;
+      trackers[i].trigger_count = HEALTH_NO_TRIGGER_COUNT;
+    }
+    if (trigger_count == HEALTH_NO_TRIGGER_COUNT) continue;
+
+    ePinId p = HEALTH_FIRST_PIN + i;
+    if (trigger_count != settings.trigger_count[p]) {
+      settings.trigger_count[p] = trigger_count;
+      DebounceSetTriggerCount(p, trigger_count);
+      if (!save_pending) {
+        save_pending = true;
+        save_from = TimebaseMicros();
+      }
+    }
+  }
+#endif
+}
+
+void HealthGet(ePinId id, sSwitchHealth *h)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    *h = health[id - HEALTH_FIRST_PIN];
+  }
+}
+
+void HealthReset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(health, 0, sizeof(health));
+  }
+}
\ No newline at end of file
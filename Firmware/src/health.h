@@ -0,0 +1,38 @@
+#ifndef HEALTH_H_
+#define HEALTH_H_
+
+#include "health.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+
+/* Only the buttons are tracked; the encoders rely on their hardware debounce */
+#define HEALTH_FIRST_PIN      BT_A
+#define HEALTH_NUM_PINS       (NUM_PINS - HEALTH_FIRST_PIN)
+
+/* Bounce duration histogram: bucket 0 holds single clean edges, bucket n
+ * holds bursts lasting 2^(n-1) to 2^n - 1 sample ticks, the last bucket the rest */
+#define HEALTH_BOUNCE_BUCKETS 8
+
+#ifndef HEALTH_AUTO_CALIBRATE
+#define HEALTH_AUTO_CALIBRATE 1
+#endif
+
+typedef struct {
+  uint16_t presses;                            // Debounced presses
+  uint16_t bursts;                             // Bounce bursts, one per physical make or break
+  uint16_t edges;                              // Raw edges over all bursts
+  uint16_t chatter;                            // Debounced changes closer together than HEALTH_CHATTER_US
+  uint8_t max_edges;                           // Most raw edges in one burst
+  uint8_t max_run;                             // Longest stable run inside a burst, in sample ticks
+  uint16_t bounce_hist[HEALTH_BOUNCE_BUCKETS]; // Burst durations
+} sSwitchHealth;
+
+void HealthInit(void);
+void HealthUpdate(void);
+void HealthSample(ePortId port, uint8_t raw_edges, uint8_t level_changes, uint8_t level, uint16_t now);
+void HealthGet(ePinId id, sSwitchHealth *health);
+void HealthReset(void);
+
+#endif /* HEALTH_H_ */
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "keymap.h"
+#include <util/atomic.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "descriptors.h"
+#include "settings.h"
+
+/* Compiled from settings.keymap, so the report builder only does a table lookup per key */
+sKeyBit keymap[KEYMAP_LAYERS][KEYMAP_NUM_KEYS];
+
+void KeymapInit(void)
+{
+  KeymapCompile();
+}
+
+/* Whether a usage fits in the NKRO report: a key in the bitmap, a modifier or nothing. Usages
+ * past the modifiers are reserved and would alias onto a modifier bit. */
+bool KeymapIsValid(uint8_t code)
+{
+  return code < KEYBOARD_BITMAP_KEYS ||
+         (code >= HID_KEYBOARD_SC_LEFT_CONTROL && code <= HID_KEYBOARD_SC_RIGHT_GUI);
+}
+
+static void KeymapCompileKey(sKeyBit *key, uint8_t code)
+{
+  if (code == KEYMAP_NONE || !KeymapIsValid(code)) {
+    key->code = KEYMAP_NONE;
+    key->index = 0;
+    key->mask = 0;
+  } else if (code >= HID_KEYBOARD_SC_LEFT_CONTROL) {
+    key->code = code;
+    key->index = 0;
+    key->mask = 1 << (code & 7);
+  } else {
+    key->code = code;
+    key->index = 1 + (code >> 3);
+    key->mask = 1 << (code & 7);
+  }
+}
+
+/* Rebuilds the table from the settings. Call after changing settings.keymap. The reports are
+ * built from interrupts, so they never see a half-compiled table. */
+void KeymapCompile(void)
+{
+  sKeyBit compiled[KEYMAP_LAYERS][KEYMAP_NUM_KEYS];
+
+  for (uint8_t l = 0; l < KEYMAP_LAYERS; l++) {
+    for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+      KeymapCompileKey(&compiled[l][k], settings.keymap[l][k]);
+    }
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy(keymap, compiled, sizeof(keymap));
+  }
+}
+
+/* Binds all keys of a layer and saves them. Returns false, changing nothing, if the layer
+ * doesn't exist or a usage can't be reported. */
+bool KeymapSetLayer(uint8_t layer, const uint8_t *codes)
+{
+  if (layer >= KEYMAP_LAYERS) return false;
+  for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+    if (!KeymapIsValid(codes[k])) return false;
+  }
+
+  memcpy(settings.keymap[layer], codes, KEYMAP_NUM_KEYS);
+  KeymapCompile();
+  SettingsSave();
+  return true;
+}
\ No newline at end of file
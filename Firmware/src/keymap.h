@@ -0,0 +1,45 @@
+#ifndef KEYMAP_H_
+#define KEYMAP_H_
+
+#include "keymap.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+
+/* Layer 0 is active normally, layer 1 while START is held. A key's binding is looked up when it
+ * is pressed and kept until it is released, so pressing or releasing START doesn't change keys
+ * that are already held. START's own binding is looked up with START pressed, in layer 1, so
+ * binding it there keeps it usable. */
+#define KEYMAP_LAYERS       2
+#define KEYMAP_LAYER_PIN    START
+
+/* The keys are the buttons, BT_A up to START */
+#define KEYMAP_FIRST_PIN    BT_A
+#define KEYMAP_NUM_KEYS     (NUM_PINS - KEYMAP_FIRST_PIN)
+
+/* Unbound keys have usage 0 */
+#define KEYMAP_NONE         0
+
+/* Compiled binding: the byte and bit a key sets in USB_NKROKeyboardReport_Data_t, plus the
+ * usage for the boot protocol report. Unbound keys have a zero mask. */
+typedef struct {
+  uint8_t code;
+  uint8_t index;
+  uint8_t mask;
+} sKeyBit;
+
+extern sKeyBit keymap[KEYMAP_LAYERS][KEYMAP_NUM_KEYS];
+
+void KeymapInit(void);
+void KeymapCompile(void);
+bool KeymapIsValid(uint8_t code);
+bool KeymapSetLayer(uint8_t layer, const uint8_t *codes);
+
+/* Bindings for the buttons in pressed, a bit per ePinId */
+static inline const sKeyBit *KeymapLayer(uint16_t pressed)
+{
+  return keymap[(pressed >> KEYMAP_LAYER_PIN) & 1];
+}
+
+#endif /* KEYMAP_H_ */
\ No newline at end of file
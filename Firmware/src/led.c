@@ -4,6 +4,7 @@
 #include <stdbool.h>
 
 #include "debounce.h"
+#include "events.h"
 #include "neopixel.h"
 
 #define NUM_BUTTONS  6
@@ -79,8 +80,18 @@ static sButtonRef buttons[NUM_BUTTONS] =
   }
 };
 
+static sEventReader led_events;
+
+/* While the host drives the lights, button presses leave them alone */
+static bool host_lights = false;
+static uint8_t host_lights_mask;
+
+/* All LEDs stay off while the bus is suspended */
+static bool suspended = false;
+
 void LedInit(void)
 {
+  EventsReaderInit(&led_events);
   NeoPixelInit();
   for (int i = 0; i < NUM_BUTTONS; i++) {
     NeoPixelSetPixelColor(buttons[i].led1, buttons[i].color_off.r, buttons[i].color_off.g, buttons[i].color_off.b);
@@ -89,22 +100,43 @@ void LedInit(void)
   NeoPixelUpdate();
 }
 
+static void LedSetButton(sButtonRef *button, bool button_level)
+{
+  button->state = button_level;
+  if (button_level) {
+    NeoPixelSetPixelColor(button->led1, button->color_off.r, button->color_off.g, button->color_off.b);
+    NeoPixelSetPixelColor(button->led2, button->color_off.r, button->color_off.g, button->color_off.b);
+  } else {
+    NeoPixelSetPixelColor(button->led1, button->color_on.r, button->color_on.g, button->color_on.b);
+    NeoPixelSetPixelColor(button->led2, button->color_on.r, button->color_on.g, button->color_on.b);
+  }
+}
+
 void LedUpdate(void)
 {
   bool neopixel_update_required = false;
+  sInputEvent event;
 
-  for (int i = 0; i < NUM_BUTTONS; i++) {
-    bool button_level = DebounceGetLevel(buttons[i].pinId);
-    
-    if (button_level != buttons[i].state) {
-      buttons[i].state = button_level;
-      neopixel_update_required = true;
-      if (button_level) {
-        NeoPixelSetPixelColor(buttons[i].led1, buttons[i].color_off.r, buttons[i].color_off.g, buttons[i].color_off.b);
-        NeoPixelSetPixelColor(buttons[i].led2, buttons[i].color_off.r, buttons[i].color_off.g, buttons[i].color_off.b);
-      } else {
-        NeoPixelSetPixelColor(buttons[i].led1, buttons[i].color_on.r, buttons[i].color_on.g, buttons[i].color_on.b);
-        NeoPixelSetPixelColor(buttons[i].led2, buttons[i].color_on.r, buttons[i].color_on.g, buttons[i].color_on.b);
+  while (EventsPeek(&led_events, &event)) {
+    EventsConsume(&led_events);
+    if (host_lights || suspended) continue;
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+      if (buttons[i].pinId == event.pin && buttons[i].state != event.level) {
+        LedSetButton(&buttons[i], event.level);
+        neopixel_update_required = true;
+      }
+    }
+  }
+
+  // Missed events, so fall back to the current levels
+  if (led_events.overrun) {
+    led_events.overrun = false;
+    if (host_lights || suspended) return;
+    for (int i = 0; i < NUM_BUTTONS; i++) {
+      bool button_level = DebounceGetLevel(buttons[i].pinId);
+      if (button_level != buttons[i].state) {
+        LedSetButton(&buttons[i], button_level);
+        neopixel_update_required = true;
       }
     }
   }
@@ -112,4 +144,43 @@ void LedUpdate(void)
   if (neopixel_update_required) {
     NeoPixelUpdate();
   }
+}
+
+/* Sets every button from the host's lights or from the button levels */
+static void LedRedraw(void)
+{
+  for (int i = 0; i < NUM_BUTTONS; i++) {
+    bool level = host_lights ? !(host_lights_mask & (1 << (buttons[i].pinId - BT_A))) : DebounceGetLevel(buttons[i].pinId);
+    LedSetButton(&buttons[i], level);
+  }
+  NeoPixelUpdate();
+}
+
+/* Hands the button lights to the host, lighting the button at ePinId BT_A + n for bit n of
+ * lights, or gives them back to the buttons. The strip is only rewritten when something changed. */
+void LedSetHostLights(bool host, uint8_t lights)
+{
+  if (host == host_lights && (!host || lights == host_lights_mask)) return;
+
+  host_lights = host;
+  host_lights_mask = lights;
+  if (!suspended) LedRedraw();
+}
+
+/* Turns every LED off while the bus is suspended, and redraws them on resume */
+void LedSetSuspended(bool suspend)
+{
+  if (suspend == suspended) return;
+
+  suspended = suspend;
+  if (!suspended) {
+    LedRedraw();
+    return;
+  }
+
+  for (int i = 0; i < NUM_BUTTONS; i++) {
+    NeoPixelSetPixelColor(buttons[i].led1, 0, 0, 0);
+    NeoPixelSetPixelColor(buttons[i].led2, 0, 0, 0);
+  }
+  NeoPixelUpdate();
 }
\ No newline at end of file
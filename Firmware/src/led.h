@@ -1,7 +1,13 @@
 #ifndef LED_H_
 #define LED_H_
 
+#include "led.h"
+#include <stdint.h>
+#include <stdbool.h>
+
 void LedInit(void);
 void LedUpdate(void);
+void LedSetHostLights(bool host, uint8_t lights);
+void LedSetSuspended(bool suspend);
 
 #endif /* LED_H_ */
\ No newline at end of file
@@ -1,16 +1,39 @@
 #include "neopixel.h"
 #include <avr/io.h>
-#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "timebase.h"
 
 #define NEOPIXEL_PORT &PORTD
 #define NEOPIXEL_PIN_MASK (1 << 5)
 #define NEOPIXEL_NUM_LEDS 12
 #define NEOPIXEL_COLORS_PER_LED 3
-#define NEOPIXEL_BYTES_PER_COLOR 2
-#define NEOPIXEL_BUFFER_SIZE (NEOPIXEL_NUM_LEDS * NEOPIXEL_COLORS_PER_LED * NEOPIXEL_BYTES_PER_COLOR)
+#define NEOPIXEL_BUFFER_SIZE (NEOPIXEL_NUM_LEDS * NEOPIXEL_COLORS_PER_LED)
+
+#define NEOPIXEL_MAX_GAP_CYCLES ((uint16_t) (NEOPIXEL_MAX_GAP_US * TIMEBASE_CYCLES_PER_US))
+#define NEOPIXEL_RESET_CYCLES   ((uint32_t) NEOPIXEL_RESET_US * TIMEBASE_CYCLES_PER_US)
+
+/* Time to send one byte, 8 bits of 20 cycles plus the loop around it, rounded up */
+#define NEOPIXEL_BYTE_CYCLES    240
+#define NEOPIXEL_FRAME_CYCLES   (NEOPIXEL_BUFFER_SIZE * NEOPIXEL_BYTE_CYCLES)
+#define NEOPIXEL_SAMPLE_CYCLES  (F_CPU / DEBOUNCE_SAMPLE_RATE_HZ)
+
+/* Room before the next sample tick a frame needs to start in. If the whole frame fits between
+ * two ticks it waits for a pass of the main loop right after a tick and then goes out without
+ * pausing for one; otherwise it has to pause over the ticks, and only each byte needs to fit. */
+#if NEOPIXEL_FRAME_CYCLES < NEOPIXEL_SAMPLE_CYCLES
+#define NEOPIXEL_START_CYCLES   NEOPIXEL_FRAME_CYCLES
+#else
+#define NEOPIXEL_START_CYCLES   NEOPIXEL_BYTE_CYCLES
+#endif
 
 static uint8_t pixelBuffer[NEOPIXEL_BUFFER_SIZE] = {0};
 static uint8_t brightness = 100;
+
+static bool frame_pending = false;
+static uint32_t frame_end;    // TimebaseNow() when the data line last went idle
  
 void NeoPixelInit(void)
 {
@@ -35,7 +58,8 @@ void NeoPixelSetPixelColor(uint8_t n, uint8_t r, uint8_t g, uint8_t b)
   p[2] = b;
 }
 
-void NeoPixelUpdate(void)
+/* Clocks out count bytes. Call with interrupts off; the bit timing is counted in cycles. */
+static void NeoPixelSendBytes(const uint8_t *data, uint16_t count)
 {
   // WS2811 and WS2812 have different hi/lo duty cycles; this is
   // similar but NOT an exact copy of the prior 400-on-8 code.
@@ -44,9 +68,9 @@ void NeoPixelUpdate(void)
   // ST instructions:         ^   ^        ^       (T=0,5,13)
   
   volatile uint16_t
-  i   = NEOPIXEL_BUFFER_SIZE; // Loop counter
+  i   = count;        // Loop counter
   volatile uint8_t
-  *ptr = pixelBuffer,   // Pointer to next byte
+  *ptr = (volatile uint8_t *) data, // Pointer to next byte
   b   = *ptr++,   // Current byte value
   hi,             // PORT w/output bit set high
   lo;             // PORT w/output bit set low
@@ -58,8 +82,6 @@ void NeoPixelUpdate(void)
   lo   = *NEOPIXEL_PORT & ~NEOPIXEL_PIN_MASK;
   next = lo;
   bit  = 8;
-  
-  cli();
 
   asm volatile(
   "head20:"                   "\n\t" // Clk  Pseudocode    (T =  0)
@@ -92,6 +114,56 @@ void NeoPixelUpdate(void)
   : [ptr]    "e" (ptr),
   [hi]     "r" (hi),
   [lo]     "r" (lo));
-  
-  sei();
+}
+
+/* Sends the pending frame one byte at a time, letting interrupts in between bytes, so they are
+ * never held off for more than one byte (about 10 us). A byte only starts if it ends before the
+ * next sample tick is due, so the sample interrupt is never delayed; the data line stays low
+ * while it runs instead. If an interrupt keeps the line low for longer than NEOPIXEL_MAX_GAP_US,
+ * the strip may have latched part of the frame. The frame is then sent again from the first
+ * pixel on a later call, once the line has been low for NEOPIXEL_RESET_US. Returns straight
+ * away while that reset time runs. */
+void NeoPixelTask(void)
+{
+  uint16_t byte_end = 0;
+
+  if (!frame_pending) return;
+  if (TimebaseNow() - frame_end < NEOPIXEL_RESET_CYCLES) return;
+
+  for (uint8_t n = 0; n < NEOPIXEL_BUFFER_SIZE; ) {
+    bool late = false;
+    bool wait = false;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      uint16_t room = DebounceGetCyclesToSample();
+
+      if (n && (uint16_t) (TimebaseCycles() - byte_end) > NEOPIXEL_MAX_GAP_CYCLES) {
+        late = true;
+      } else if (room >= (n ? NEOPIXEL_BYTE_CYCLES : NEOPIXEL_START_CYCLES)) {
+        NeoPixelSendBytes(&pixelBuffer[n++], 1);
+        byte_end = TimebaseCycles();
+      } else if (!n) {
+        wait = true;
+      }
+      // Otherwise the line stays low, with interrupts open, until the sample tick has run
+    }
+
+    // Try again on a later pass, after the next tick
+    if (wait) return;
+
+    if (late) {
+      frame_end = TimebaseNow();
+      return;
+    }
+  }
+
+  frame_pending = false;
+  frame_end = TimebaseNow();
+}
+
+/* Queues the buffer to be sent, and starts on it if the strip is ready */
+void NeoPixelUpdate(void)
+{
+  frame_pending = true;
+  NeoPixelTask();
 }  
\ No newline at end of file
@@ -3,9 +3,25 @@
 
 #include <stdint.h>
 
+/* Longest low time between two bytes that the LEDs still take as the same frame. The default
+ * is set against the SK6812, one of the two parts in the bill of materials: its datasheet asks
+ * for 80 us low to reset, and this stays at half of that. It has to be longer than the sample
+ * interrupt, which the frame has to pause for, so check it against the s.cost worst case.
+ * WS2812 and WS2812B parts latch after well under 10 us low, which no interrupt fits under;
+ * see the README. */
+#ifndef NEOPIXEL_MAX_GAP_US
+#define NEOPIXEL_MAX_GAP_US 40
+#endif
+
+/* Low time that is sure to latch a frame, including on parts that need 280 us */
+#ifndef NEOPIXEL_RESET_US
+#define NEOPIXEL_RESET_US 300
+#endif
+
 void NeoPixelInit(void);
 void NeoPixelSetBrightness(uint8_t b);
 void NeoPixelSetPixelColor(uint8_t n, uint8_t r, uint8_t g, uint8_t b);
 void NeoPixelUpdate(void);
+void NeoPixelTask(void);
 
 #endif /* NEOPIXEL_H_ */
\ No newline at end of file
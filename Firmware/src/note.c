@@ -7,13 +7,23 @@
 #include <LUFA/Drivers/USB/USB.h>
 #include <LUFA/Platform/Platform.h>
 #include "descriptors.h"
+#include "console.h"
 #include "encoder.h"
 #include "debounce.h"
+#include "health.h"
+#include "keymap.h"
 #include "led.h"
+#include "neopixel.h"
+#include "power.h"
+#include "rawhid.h"
+#include "reports.h"
+#include "serialio.h"
+#include "settings.h"
+#include "timebase.h"
+#include "timing.h"
 
 /* Function Prototypes: */
 void SetupHardware(void);
-void SendSerial(void);
 
 void EVENT_USB_Device_Connect(void);
 void EVENT_USB_Device_Disconnect(void);
@@ -32,6 +42,7 @@ void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDI
                                           const void* ReportData,
                                           const uint16_t ReportSize);
 
+#if USB_CDC
 /** LUFA CDC Class driver interface configuration and state information. This structure is
  *  passed to all CDC Class driver functions, so that multiple instances of the same class
  *  within a device can be differentiated from one another.
@@ -66,53 +77,7 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
  *  used like any regular character stream in the C APIs.
  */
 static FILE USBSerialStream;
-
-/** Buffer to hold the previously generated Keyboard HID report, for comparison purposes inside the HID class driver. */
-static uint8_t PrevKeyboardHIDReportBuffer[sizeof(USB_KeyboardReport_Data_t)];
-
-/** Buffer to hold the previously generated Mouse HID report, for comparison purposes inside the HID class driver. */
-static uint8_t PrevMouseHIDReportBuffer[sizeof(USB_MouseReport_Data_t)];
-
-/** LUFA HID Class driver interface configuration and state information. This structure is
- *  passed to all HID Class driver functions, so that multiple instances of the same class
- *  within a device can be differentiated from one another. This is for the keyboard HID
- *  interface within the device.
- */
-USB_ClassInfo_HID_Device_t Keyboard_HID_Interface =
-  {
-    .Config =
-      {
-        .InterfaceNumber              = INTERFACE_ID_Keyboard,
-        .ReportINEndpoint             =
-          {
-            .Address              = KEYBOARD_IN_EPADDR,
-            .Size                 = HID_EPSIZE,
-            .Banks                = 1,
-          },
-        .PrevReportINBuffer           = PrevKeyboardHIDReportBuffer,
-        .PrevReportINBufferSize       = sizeof(PrevKeyboardHIDReportBuffer),
-      },
-  };
-
-/** LUFA HID Class driver interface configuration and state information. This structure is
- *  passed to all HID Class driver functions, so that multiple instances of the same class
- *  within a device can be differentiated from one another.
- */
-USB_ClassInfo_HID_Device_t Mouse_HID_Interface =
-  {
-    .Config =
-      {
-        .InterfaceNumber                = INTERFACE_ID_Mouse,
-        .ReportINEndpoint               =
-          {
-            .Address                = MOUSE_IN_EPADDR,
-            .Size                   = HID_EPSIZE,
-            .Banks                  = 1,
-          },
-        .PrevReportINBuffer             = PrevMouseHIDReportBuffer,
-        .PrevReportINBufferSize         = sizeof(PrevMouseHIDReportBuffer),
-      },
-  };
+#endif
 
 /** Configures the board hardware and chip peripherals for the demo's functionality. */
 void SetupHardware(void)
@@ -130,9 +95,22 @@ void SetupHardware(void)
   PORTB |= (1<<0) | (1<<4) | (1<<5) | (1<<7);
 
   /* Subsystem Initialization */
+  SettingsInit();
+  KeymapInit();
+  TimebaseInit();
+  TimingInit();
   EncoderInit();
+  HealthInit();
   DebounceInit();
   LedInit();
+  PowerInit();
+
+  /* Pick the USB profile before the host can ask for descriptors. Holding START while plugging
+     in swaps the stored profile for the other one, so either is reachable without the console */
+  USB_Profile = (settings.usb_profile < USB_PROFILE_COUNT) ? settings.usb_profile : USB_PROFILE_Full;
+  if (!(PINE & (1<<2))) {
+    USB_Profile = (USB_Profile == USB_PROFILE_Full) ? USB_PROFILE_Tournament : USB_PROFILE_Full;
+  }
 
   USB_Init();
 }
@@ -147,49 +125,64 @@ int main(void)
 {
   SetupHardware();
 
+#if USB_CDC
   /* Create a regular character stream for the interface so that it can be used with the stdio.h functions */
   CDC_Device_CreateStream(&VirtualSerial_CDC_Interface, &USBSerialStream);
+  ConsoleInit(&USBSerialStream);
+  SerialIoInit(&VirtualSerial_CDC_Interface);
+#endif
+  ReportsInit();
+#if USB_RAW_HID
+  RawHidInit();
+#endif
 
   GlobalInterruptEnable();
 
   while(1)
   {
-    DebounceUpdate();
-    EncoderUpdate();
-    LedUpdate();
+    TimingLoop();
+    HealthUpdate();
+    SettingsUpdate();
+    PowerUpdate();
+    NeoPixelTask();
+
+    /* The tournament profile has no console or raw interface, and leaves the LEDs as LedInit() set them */
+    bool full = (USB_Profile == USB_PROFILE_Full);
+
+    if (full) {
+      LedUpdate();
+#if USB_CDC
+      SerialIoUpdate();
+      if (!SerialIoActive()) ConsoleUpdate();
+#endif
+#if USB_RAW_HID
+      RawHidUpdate();
+#endif
+    }
 
-    SendSerial();
+    uint32_t usb_start = TimebaseNow();
 
-    /* Must throw away unused bytes from the host, or it will lock up while waiting for the device */
-    CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+#if USB_CDC
+    if (full) {
+      /* Must consume all bytes from the host, or it will lock up while waiting for the device */
+      int16_t c = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+      if (!SerialIoProcessByte(c)) ConsoleProcessByte(c);
 
-    CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
-    HID_Device_USBTask(&Mouse_HID_Interface);
-    HID_Device_USBTask(&Keyboard_HID_Interface);
+      CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
+    }
+#endif
+    ReportsUpdate();
 
     USB_USBTask();
-  }
-}
-
-/** Send debug information over serial */
-void SendSerial(void)
-{
-  char ReportString[70];
-  /*
-  uint8_t leftdelta = EncoderGetLeftDelta();
-  uint8_t rightdelta = EncoderGetRightDelta();
-
-  if (leftdelta || rightdelta) {
-    sprintf(ReportString, "Left: %i, Right: %i ", leftdelta, rightdelta);
-    fputs(ReportString, &USBSerialStream);
-  }
-  */
 
-  //sprintf(ReportString, "Debounce Stats: avg(%u) min(%u) max(%u) 4us counts\r\n", debounce_stats.avg, debounce_stats.min, debounce_stats.max);
-  //fputs(ReportString, &USBSerialStream);
+    TimingRecord(TIMING_USB, TimebaseNow() - usb_start);
 
-  /* Alternatively, without the stream: */
-  // CDC_Device_SendString(&VirtualSerial_CDC_Interface, ReportString);
+#if USB_CDC
+    /* Bytes from the host don't raise an interrupt, so stay awake until they are all read */
+    if (full && CDC_Device_BytesReceived(&VirtualSerial_CDC_Interface)) continue;
+#endif
+    PowerIdle();
+  }
 }
 
 /** Event handler for the library USB Connection event. */
@@ -207,9 +200,15 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 {
   bool ConfigSuccess = true;
 
-  ConfigSuccess &= HID_Device_ConfigureEndpoints(&Keyboard_HID_Interface);
-  ConfigSuccess &= HID_Device_ConfigureEndpoints(&Mouse_HID_Interface);
-  ConfigSuccess &= CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
+  ConfigSuccess &= ReportsConfigureEndpoints();
+  if (USB_Profile == USB_PROFILE_Full) {
+#if USB_RAW_HID
+    ConfigSuccess &= RawHidConfigureEndpoints();
+#endif
+#if USB_CDC
+    ConfigSuccess &= CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
+#endif
+  }
 
   USB_Device_EnableSOFEvents();
 }
@@ -217,19 +216,31 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 /** Event handler for the library USB Control Request reception event. */
 void EVENT_USB_Device_ControlRequest(void)
 {
-  HID_Device_ProcessControlRequest(&Keyboard_HID_Interface);
-  HID_Device_ProcessControlRequest(&Mouse_HID_Interface);
+  ReportsProcessControlRequest();
+  if (USB_Profile != USB_PROFILE_Full) return;
+#if USB_RAW_HID
+  RawHidProcessControlRequest();
+#endif
+#if USB_CDC
   CDC_Device_ProcessControlRequest(&VirtualSerial_CDC_Interface);
+#endif
 }
 
 /** Event handler for the USB device Start Of Frame event. */
 void EVENT_USB_Device_StartOfFrame(void)
 {
-  HID_Device_MillisecondElapsed(&Keyboard_HID_Interface);
-  HID_Device_MillisecondElapsed(&Mouse_HID_Interface);
+  DebounceFrame();
+  ReportsFrame();
+#if USB_RAW_HID
+  RawHidFrame();
+#endif
 }
 
-/** HID class driver callback function for the creation of HID reports to the host.
+/** HID class driver callback function for the creation of HID reports to the host. Never called:
+ *  reports.c builds and stages the reports itself and answers the HID class requests, so
+ *  HID_Device_USBTask() and HID_Device_ProcessControlRequest() are never run. The stub only exists
+ *  because the HID class driver is still built, for HID_Device_ConfigureEndpoints() and the
+ *  USB_ClassInfo_HID_Device_t state that reports.c keeps, and it references this callback.
  *
  *  \param[in]     HIDInterfaceInfo  Pointer to the HID class interface configuration structure being referenced
  *  \param[in,out] ReportID    Report ID requested by the host if non-zero, otherwise callback should set to the generated report ID
@@ -244,50 +255,14 @@ bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDIn
                                          void* ReportData,
                                          uint16_t* const ReportSize)
 {
-  if (HIDInterfaceInfo == &Keyboard_HID_Interface) {
-    USB_KeyboardReport_Data_t* KeyboardReport = (USB_KeyboardReport_Data_t*)ReportData;
-
-    //KeyboardReport->Modifier = HID_KEYBOARD_MODIFIER_LEFTSHIFT;
-    if (!DebounceGetLevel(BT_A)) {
-      KeyboardReport->KeyCode[0] = HID_KEYBOARD_SC_S;
-    }
-    if (!DebounceGetLevel(BT_B)) {
-      KeyboardReport->KeyCode[1] = HID_KEYBOARD_SC_D;
-    }
-    if (!DebounceGetLevel(BT_C)) {
-      KeyboardReport->KeyCode[2] = HID_KEYBOARD_SC_K;
-    }
-    if (!DebounceGetLevel(BT_D)) {
-      KeyboardReport->KeyCode[3] = HID_KEYBOARD_SC_L;
-    }
-    if (!DebounceGetLevel(FX_L)) {
-      KeyboardReport->KeyCode[4] = HID_KEYBOARD_SC_V;
-    }
-    if (!DebounceGetLevel(FX_R)) {
-      KeyboardReport->KeyCode[5] = HID_KEYBOARD_SC_M;
-    }
-    if (!DebounceGetLevel(START)) {
-      KeyboardReport->KeyCode[0] = HID_KEYBOARD_SC_ENTER;
-    }
-
-    *ReportSize = sizeof(USB_KeyboardReport_Data_t);
-    return false;
-  } else {
-    USB_MouseReport_Data_t* MouseReport = (USB_MouseReport_Data_t*)ReportData;
-
-    MouseReport->Y = -1*EncoderGetRightDelta();
-    MouseReport->X = 1*EncoderGetLeftDelta();
-
-    EncoderResetLeftDelta();
-    EncoderResetRightDelta();
-
-    *ReportSize = sizeof(USB_MouseReport_Data_t);
-    return true;
-  }
+  // Sends nothing if it is ever reached
+  *ReportSize = 0;
   return false;
 }
 
-/** HID class driver callback function for the processing of HID reports from the host.
+/** HID class driver callback function for the processing of HID reports from the host. Never
+ *  called, for the same reason as CALLBACK_HID_Device_CreateHIDReport(); reports.c reads and drops
+ *  the keyboard LED report itself.
  *
  *  \param[in] HIDInterfaceInfo  Pointer to the HID class interface configuration structure being referenced
  *  \param[in] ReportID    Report ID of the received report from the host
@@ -301,7 +276,6 @@ void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDI
                                           const void* ReportData,
                                           const uint16_t ReportSize)
 {
-  // Unused (but mandatory for the HID class driver) in this demo, since there are no Host->Device reports
 }
 
 /** CDC class driver callback function the processing of changes to the virtual
@@ -317,5 +291,10 @@ void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t *const C
      application blocking while waiting for a host to become ready and read
      in the pending data from the USB endpoints.
   */
-  //bool HostReady = (CDCInterfaceInfo->State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR) != 0;
+#if USB_CDC
+  bool HostReady = (CDCInterfaceInfo->State.ControlLineStates.HostToDevice & CDC_CONTROL_LINE_OUT_DTR) != 0;
+
+  /* Closing the port ends a binary IO session, handing the port back to the console */
+  if (!HostReady) SerialIoClose();
+#endif
 }
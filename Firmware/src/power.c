@@ -0,0 +1,68 @@
+#include "power.h"
+#include <avr/sleep.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <LUFA/Drivers/USB/USB.h>
+#include "debounce.h"
+#include "events.h"
+#include "led.h"
+#include "timebase.h"
+
+/* Suspend handling. The bus state is polled from the main loop, which keeps running while
+ * suspended since the sample timer still wakes it. Only PORTB and PD0..2 have pin interrupts,
+ * so the CPU stays in idle sleep rather than power-down, and the sampler keeps seeing the
+ * buttons that can't wake it by themselves. */
+
+static bool suspended = false;
+static uint32_t suspend_us;
+static sEventReader power_events;
+
+void PowerInit(void)
+{
+  suspended = false;
+  EventsReaderInit(&power_events);
+}
+
+static bool PowerButtonPressed(void)
+{
+  sInputEvent event;
+  bool pressed = false;
+
+  while (EventsPeek(&power_events, &event)) {
+    EventsConsume(&power_events);
+    if (event.pin >= BT_A && !event.level) pressed = true;
+  }
+  power_events.overrun = false;
+  return pressed;
+}
+
+/* Turns the LEDs off while the host has suspended the bus, and asks the host to resume when a
+ * button is pressed, if it allowed remote wakeup */
+void PowerUpdate(void)
+{
+  bool now_suspended = (USB_DeviceState == DEVICE_STATE_Suspended);
+
+  if (now_suspended != suspended) {
+    suspended = now_suspended;
+    suspend_us = TimebaseMicros();
+    EventsReaderInit(&power_events);
+    LedSetSuspended(suspended);
+  }
+
+  if (!suspended || !PowerButtonPressed()) return;
+
+  if (USB_Device_RemoteWakeupEnabled && TimebaseMicros() - suspend_us >= POWER_WAKEUP_MIN_SUSPEND_US) {
+    USB_Device_SendRemoteWakeup();
+  }
+}
+
+/* Sleeps until the next interrupt. The sample timer fires every sample period, so work an
+ * interrupt leaves for the main loop waits no longer than that. */
+void PowerIdle(void)
+{
+#if POWER_IDLE_SLEEP
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_mode();
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef POWER_H_
+#define POWER_H_
+
+#include "power.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Idle sleep: the main loop sleeps until the next interrupt once a pass is done. Input is
+ * sampled and reports are staged from interrupts, so sleeping adds no input latency. */
+#ifndef POWER_IDLE_SLEEP
+#define POWER_IDLE_SLEEP 1
+#endif
+
+/* The bus has to be idle this long before the device may signal remote wakeup */
+#define POWER_WAKEUP_MIN_SUSPEND_US 5000
+
+void PowerInit(void);
+void PowerUpdate(void);
+void PowerIdle(void);
+
+#endif /* POWER_H_ */
\ No newline at end of file
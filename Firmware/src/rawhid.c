@@ -0,0 +1,233 @@
+#include "rawhid.h"
+#include <util/atomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "health.h"
+#include "keymap.h"
+#include "settings.h"
+#include "timebase.h"
+#include "timing.h"
+
+#if USB_RAW_HID
+
+/* The settings commands carry everything up to the keymap, which has its own commands */
+#define RAW_SETTINGS_SIZE offsetof(sSettings, keymap)
+
+/* Command from the host, run by the main loop so it never races the settings writer */
+static sRawCommand command;
+static volatile bool command_pending = false;
+
+static sRawReply reply;
+
+/* Telemetry interval in frames, 0 while stopped */
+static uint8_t stream_frames = 0;
+static uint8_t stream_countdown;
+static uint8_t stream_sequence;
+
+void RawHidInit(void)
+{
+  command_pending = false;
+  stream_frames = 0;
+}
+
+static eRawStatus RawHidRun(void)
+{
+  uint8_t arg = command.argument[0];
+
+  switch (command.command) {
+    case RAW_CMD_INFO: {
+      sRawInfo *info = (sRawInfo *) reply.payload;
+      info->settings_version = SETTINGS_VERSION;
+      info->num_pins = NUM_PINS;
+      info->num_knobs = NUM_KNOBS;
+      info->num_timings = NUM_TIMINGS;
+      info->sample_rate_hz = DEBOUNCE_SAMPLE_RATE_HZ;
+      info->cycles_per_us = TIMEBASE_CYCLES_PER_US;
+      return RAW_STATUS_OK;
+    }
+    case RAW_CMD_HEALTH:
+      if (arg < HEALTH_FIRST_PIN || arg >= NUM_PINS) return RAW_STATUS_BAD_ARGUMENT;
+      reply.payload[0] = settings.trigger_count[arg];
+      HealthGet(arg, (sSwitchHealth *) &reply.payload[1]);
+      return RAW_STATUS_OK;
+    case RAW_CMD_KNOB_STATS:
+      for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+        EncoderGetStats(k, &((sEncoderStats *) reply.payload)[k]);
+      }
+      return RAW_STATUS_OK;
+    case RAW_CMD_TIMING:
+      if (arg >= NUM_TIMINGS) return RAW_STATUS_BAD_ARGUMENT;
+      TimingGet(arg, (sTimingSummary *) reply.payload);
+      return RAW_STATUS_OK;
+    case RAW_CMD_RESET_STATS:
+      HealthReset();
+      EncoderResetStats();
+      TimingReset();
+      return RAW_STATUS_OK;
+    case RAW_CMD_GET_SETTINGS:
+      _Static_assert(RAW_SETTINGS_SIZE <= sizeof(reply.payload), "settings don't fit in a raw report");
+      memcpy(reply.payload, &settings, RAW_SETTINGS_SIZE);
+      return RAW_STATUS_OK;
+    case RAW_CMD_SET_SETTINGS: {
+      const sSettings *next = (const sSettings *) command.argument;
+      if (next->version != SETTINGS_VERSION) return RAW_STATUS_BAD_ARGUMENT;
+      if (next->usb_profile >= USB_PROFILE_COUNT) return RAW_STATUS_BAD_ARGUMENT;
+      for (ePinId p = 0; p < NUM_PINS; p++) {
+        if (!next->trigger_count[p] || next->trigger_count[p] > DEBOUNCE_TRIGGER_COUNT_MAX) {
+          return RAW_STATUS_BAD_ARGUMENT;
+        }
+      }
+      // The knob settings are read by reports built in interrupts
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(&settings, next, RAW_SETTINGS_SIZE);
+      }
+      for (ePinId p = 0; p < NUM_PINS; p++) {
+        DebounceSetTriggerCount(p, settings.trigger_count[p]);
+      }
+      SettingsSave();
+      return RAW_STATUS_OK;
+    }
+    case RAW_CMD_DEFAULTS:
+      SettingsApplyDefaults();
+      return RAW_STATUS_OK;
+    case RAW_CMD_STREAM:
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        stream_frames = arg;
+        stream_countdown = arg;
+      }
+      return RAW_STATUS_OK;
+    case RAW_CMD_GET_KEYMAP:
+      _Static_assert(sizeof(settings.keymap) <= sizeof(reply.payload), "keymap doesn't fit in a raw report");
+      memcpy(reply.payload, settings.keymap, sizeof(settings.keymap));
+      return RAW_STATUS_OK;
+    case RAW_CMD_SET_KEYMAP:
+      if (!KeymapSetLayer(arg, &command.argument[1])) return RAW_STATUS_BAD_ARGUMENT;
+      return RAW_STATUS_OK;
+  }
+  return RAW_STATUS_UNKNOWN;
+}
+
+/* Runs the command the host wrote, if any */
+void RawHidUpdate(void)
+{
+  if (!command_pending) return;
+
+  uint8_t status = RawHidRun();
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    reply.status = status;
+    command_pending = false;
+  }
+}
+
+static void RawHidFillTelemetry(sRawTelemetry *report)
+{
+  for (ePinId p = 0; p < NUM_PINS; p++) {
+    if (!DebounceGetLevel(p)) report->pressed |= (1 << p);
+  }
+  report->time_us = TimebaseMicros();
+  report->sample_age_us = DebounceGetSampleAge() / TIMEBASE_CYCLES_PER_US;
+  for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+    EncoderGetMotion(k, &report->motion[k]);
+    EncoderGetStats(k, &report->knob_stats[k]);
+  }
+}
+
+/* Called from the start of frame interrupt. Sends a telemetry report every stream_frames
+ * frames while streaming. If the host hasn't taken the last one yet, the report is skipped and
+ * the gap shows in the sequence number. Like the HID reports, it puts back the endpoint that
+ * the interrupted code had selected. */
+void RawHidFrame(void)
+{
+  sRawTelemetry report;
+
+  if (!stream_frames || USB_DeviceState != DEVICE_STATE_Configured) return;
+  if (--stream_countdown) return;
+  stream_countdown = stream_frames;
+
+  uint8_t sequence = stream_sequence++;
+
+  uint8_t prev_endpoint = Endpoint_GetCurrentEndpoint();
+  Endpoint_SelectEndpoint(RAW_IN_EPADDR);
+
+  if (Endpoint_IsINReady()) {
+    memset(&report, 0, sizeof(report));
+    report.sequence = sequence;
+    RawHidFillTelemetry(&report);
+
+    const uint8_t *data = (const uint8_t *) &report;
+    for (uint8_t i = 0; i < sizeof(report); i++) {
+      Endpoint_Write_8(data[i]);
+    }
+    Endpoint_ClearIN();
+  }
+
+  Endpoint_SelectEndpoint(prev_endpoint);
+}
+
+bool RawHidConfigureEndpoints(void)
+{
+  stream_frames = 0;
+  return Endpoint_ConfigureEndpoint(RAW_IN_EPADDR, EP_TYPE_INTERRUPT, RAW_EPSIZE, 1);
+}
+
+/* Handles the HID class requests for the raw interface. Commands arrive as output or feature
+ * reports, and only the reply is answered from here, so the control interrupt stays short. A
+ * command that arrives while the last one is still pending is stalled. */
+void RawHidProcessControlRequest(void)
+{
+  if (!(Endpoint_IsSETUPReceived())) return;
+  if (USB_ControlRequest.wIndex != INTERFACE_ID_Raw) return;
+
+  switch (USB_ControlRequest.bRequest)
+  {
+    case HID_REQ_GetReport:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        uint8_t type = (USB_ControlRequest.wValue >> 8) - 1;
+
+        if (type == HID_REPORT_ITEM_Feature) {
+          Endpoint_ClearSETUP();
+          Endpoint_Write_Control_Stream_LE(&reply, sizeof(reply));
+          Endpoint_ClearOUT();
+        } else if (type == HID_REPORT_ITEM_In) {
+          sRawTelemetry report;
+
+          memset(&report, 0, sizeof(report));
+          report.sequence = stream_sequence;
+          RawHidFillTelemetry(&report);
+
+          Endpoint_ClearSETUP();
+          Endpoint_Write_Control_Stream_LE(&report, sizeof(report));
+          Endpoint_ClearOUT();
+        }
+      }
+      break;
+    case HID_REQ_SetReport:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        if (command_pending || USB_ControlRequest.wLength != sizeof(command)) break;
+
+        Endpoint_ClearSETUP();
+        Endpoint_Read_Control_Stream_LE(&command, sizeof(command));
+        Endpoint_ClearIN();
+
+        memset(&reply, 0, sizeof(reply));
+        reply.command = command.command;
+        reply.sequence = command.sequence;
+        reply.status = RAW_STATUS_PENDING;
+        command_pending = true;
+      }
+      break;
+    case HID_REQ_SetIdle:
+      // Telemetry has its own rate, so the idle rate is accepted and ignored
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        Endpoint_ClearSETUP();
+        Endpoint_ClearStatusStage();
+      }
+      break;
+  }
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef RAWHID_H_
+#define RAWHID_H_
+
+#include "rawhid.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "descriptors.h"
+#include "encoder.h"
+
+/* Vendor-defined HID interface for configuration and telemetry, which needs no host driver.
+ * The host writes a command as an output or feature report and reads the reply back as a
+ * feature report. Telemetry streams on the interrupt IN endpoint while enabled. Every report
+ * is RAW_REPORT_SIZE bytes, without a report ID. */
+
+typedef enum {
+  RAW_CMD_INFO = 1,         // Reply: sRawInfo
+  RAW_CMD_HEALTH,           // Argument: pin. Reply: trigger count, then sSwitchHealth
+  RAW_CMD_KNOB_STATS,       // Reply: sEncoderStats per knob
+  RAW_CMD_TIMING,           // Argument: eTimingId. Reply: sTimingSummary
+  RAW_CMD_RESET_STATS,      // Resets the health, knob and timing counters
+  RAW_CMD_GET_SETTINGS,     // Reply: sSettings up to the keymap
+  RAW_CMD_SET_SETTINGS,     // Argument: sSettings of the current version up to the keymap, saved to EEPROM
+  RAW_CMD_DEFAULTS,         // Restores and saves the default settings
+  RAW_CMD_STREAM,           // Argument: frames between telemetry reports, 0 stops
+  RAW_CMD_GET_KEYMAP,       // Reply: usage per key, for every layer
+  RAW_CMD_SET_KEYMAP,       // Argument: layer, then the usage per key, saved to EEPROM
+} eRawCommand;
+
+typedef enum {
+  RAW_STATUS_OK = 0,
+  RAW_STATUS_PENDING,       // Not run yet; read the reply again
+  RAW_STATUS_UNKNOWN,       // No such command
+  RAW_STATUS_BAD_ARGUMENT,
+} eRawStatus;
+
+/* Output or feature report from the host */
+typedef struct {
+  uint8_t command;          // eRawCommand
+  uint8_t sequence;         // Echoed in the reply
+  uint8_t argument[RAW_REPORT_SIZE - 2];
+} __attribute__((packed)) sRawCommand;
+
+/* Feature report to the host, for the last command received */
+typedef struct {
+  uint8_t command;
+  uint8_t sequence;
+  uint8_t status;           // eRawStatus
+  uint8_t reserved;
+  uint8_t payload[RAW_REPORT_SIZE - 4];
+} __attribute__((packed)) sRawReply;
+
+typedef struct {
+  uint8_t settings_version;
+  uint8_t num_pins;
+  uint8_t num_knobs;
+  uint8_t num_timings;
+  uint16_t sample_rate_hz;
+  uint16_t cycles_per_us;
+} __attribute__((packed)) sRawInfo;
+
+/* Input report streamed on the IN endpoint */
+typedef struct {
+  uint8_t sequence;         // Counts up by one per report, so the host can spot gaps
+  uint8_t reserved;
+  uint16_t pressed;         // Debounced state, bit n set while the pin at ePinId n is low
+  uint32_t time_us;         // TimebaseMicros() when the report was built
+  sEncoderMotion motion[NUM_KNOBS];
+  sEncoderStats knob_stats[NUM_KNOBS];
+  uint16_t sample_age_us;   // Age of the newest sample at the next frame start, see DebounceGetSampleAge()
+  uint8_t padding[RAW_REPORT_SIZE - 26];
+} __attribute__((packed)) sRawTelemetry;
+
+void RawHidInit(void);
+void RawHidUpdate(void);
+void RawHidFrame(void);
+bool RawHidConfigureEndpoints(void);
+void RawHidProcessControlRequest(void);
+
+#endif /* RAWHID_H_ */
\ No newline at end of file
@@ -0,0 +1,581 @@
+#include "reports.h"
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "encoder.h"
+#include "events.h"
+#include "keymap.h"
+#include "timebase.h"
+#include "timing.h"
+
+/* Room for any report this device sends */
+typedef union
+{
+  USB_NKROKeyboardReport_Data_t Keyboard;
+  USB_KeyboardReport_Data_t Boot;
+  USB_KnobReport_Data_t Knobs;
+  USB_JoystickReport_Data_t Joystick;
+} uReport;
+
+#if USB_SINGLE_HID
+/* Previously sent combined report, to tell whether the next one changed */
+#if USB_JOYSTICK_HID
+static uint8_t PrevInputHIDReportBuffer[sizeof(USB_JoystickReport_Data_t)];
+#else
+static uint8_t PrevInputHIDReportBuffer[sizeof(USB_KnobReport_Data_t)];
+#endif
+
+USB_ClassInfo_HID_Device_t Input_HID_Interface =
+  {
+    .Config =
+      {
+        .InterfaceNumber                = INTERFACE_ID_Input,
+        .ReportINEndpoint               =
+          {
+            .Address                = INPUT_IN_EPADDR,
+            .Size                   = INPUT_EPSIZE,
+            .Banks                  = 2,
+          },
+        .PrevReportINBuffer             = PrevInputHIDReportBuffer,
+        .PrevReportINBufferSize         = sizeof(PrevInputHIDReportBuffer),
+      },
+  };
+#else
+/* Previously sent reports, to tell whether the next one changed */
+static uint8_t PrevKeyboardHIDReportBuffer[sizeof(USB_NKROKeyboardReport_Data_t)];
+static uint8_t PrevMouseHIDReportBuffer[sizeof(USB_KnobReport_Data_t)];
+
+USB_ClassInfo_HID_Device_t Keyboard_HID_Interface =
+  {
+    .Config =
+      {
+        .InterfaceNumber              = INTERFACE_ID_Keyboard,
+        .ReportINEndpoint             =
+          {
+            .Address              = KEYBOARD_IN_EPADDR,
+            .Size                 = KEYBOARD_EPSIZE,
+            .Banks                = 2,
+          },
+        .PrevReportINBuffer           = PrevKeyboardHIDReportBuffer,
+        .PrevReportINBufferSize       = sizeof(PrevKeyboardHIDReportBuffer),
+      },
+  };
+
+USB_ClassInfo_HID_Device_t Mouse_HID_Interface =
+  {
+    .Config =
+      {
+        .InterfaceNumber                = INTERFACE_ID_Mouse,
+        .ReportINEndpoint               =
+          {
+            .Address                = MOUSE_IN_EPADDR,
+            .Size                   = MOUSE_EPSIZE,
+            .Banks                  = 2,
+          },
+        .PrevReportINBuffer             = PrevMouseHIDReportBuffer,
+        .PrevReportINBufferSize         = sizeof(PrevMouseHIDReportBuffer),
+      },
+  };
+#endif
+
+/* Frames after the last input change in which the start of frame interrupt keeps staging
+ * reports. This covers endpoints that were busy, edges held back for the next report and the
+ * knob velocity decaying to zero. The velocity only reaches zero once the knob has been still
+ * for ENCODER_STOP_US, so the window runs one 1 ms frame past that, and the last report staged
+ * carries zero velocity instead of a stale one. */
+#define REPORTS_ACTIVE_FRAMES (ENCODER_STOP_US / 1000 + 1)
+
+_Static_assert(REPORTS_ACTIVE_FRAMES <= UINT8_MAX, "active frame count doesn't fit in a byte");
+
+/* Reader for the button events that make up the keyboard or combined report */
+static sEventReader button_events;
+
+/* Buttons currently pressed in the report, one bit per ePinId */
+static uint16_t buttons_pressed = 0;
+
+#if !USB_SINGLE_HID
+/* Binding of each pressed key, latched when it was pressed */
+static sKeyBit held_keys[KEYMAP_NUM_KEYS];
+#endif
+
+void ReportsInit(void)
+{
+  EventsReaderInit(&button_events);
+}
+
+/* Latches the bindings of newly pressed buttons from the layer they were pressed in */
+static void ReportsLatchKeys(uint16_t pressed)
+{
+#if !USB_SINGLE_HID
+  const sKeyBit *keys = KeymapLayer(buttons_pressed);
+  uint16_t pressed_keys = pressed >> KEYMAP_FIRST_PIN;
+
+  for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+    if ((pressed_keys >> k) & 1) held_keys[k] = keys[k];
+  }
+#endif
+}
+
+/* Applies the queued button events up to the cut time to the report state, in order. A pin
+ * that changes twice before a report is built keeps its second edge for the next report, so
+ * a tap shorter than the polling interval is still reported as a press. Edges after the cut
+ * also wait for the next report. */
+static void ReportsApplyEvents(uint32_t cut)
+{
+  sInputEvent event;
+  uint16_t changed = 0;
+
+  while (EventsPeek(&button_events, &event)) {
+    uint16_t mask = (1 << event.pin);
+    if (changed & mask) break;
+    if ((int32_t) (event.time_us - cut) > 0) break;
+
+    EventsConsume(&button_events);
+    changed |= mask;
+    if (event.level) {
+      buttons_pressed &= ~mask;
+    } else {
+      buttons_pressed |= mask;
+      ReportsLatchKeys(mask);
+    }
+    TimingRecord(TIMING_EDGE_TO_REPORT, (cut - event.time_us) * TIMEBASE_CYCLES_PER_US);
+  }
+
+  // Missed events, so fall back to the current levels
+  if (button_events.overrun) {
+    uint16_t was_pressed = buttons_pressed;
+
+    button_events.overrun = false;
+    buttons_pressed = 0;
+    for (ePinId p = BT_A; p < NUM_PINS; p++) {
+      if (!DebounceGetLevel(p)) buttons_pressed |= (1 << p);
+    }
+    ReportsLatchKeys(buttons_pressed & ~was_pressed);
+  }
+}
+
+#if !USB_SINGLE_HID
+/* Builds the NKRO report from the pressed buttons without a branch per button.
+ * The report must start out zeroed. */
+static void ReportsFillKeyboard(uint8_t *report)
+{
+  const sKeyBit *keys = held_keys;
+  uint16_t pressed_keys = buttons_pressed >> KEYMAP_FIRST_PIN;
+
+  for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+    uint8_t pressed = -(uint8_t) ((pressed_keys >> k) & 1);
+    report[keys[k].index] |= keys[k].mask & pressed;
+  }
+}
+
+/* Builds the standard boot protocol report for hosts that ask for it. More than six keys
+ * reports a rollover error, as the boot protocol requires. */
+static void ReportsFillBootKeyboard(USB_KeyboardReport_Data_t *report)
+{
+  const sKeyBit *keys = held_keys;
+  uint8_t slot = 0;
+
+  for (uint8_t k = 0; k < KEYMAP_NUM_KEYS; k++) {
+    if (!(buttons_pressed & (1 << (KEYMAP_FIRST_PIN + k)))) continue;
+
+    uint8_t code = keys[k].code;
+    if (code == KEYMAP_NONE) continue;
+    if (code >= HID_KEYBOARD_SC_LEFT_CONTROL) {
+      report->Modifier |= keys[k].mask;
+    } else if (slot < sizeof(report->KeyCode)) {
+      report->KeyCode[slot++] = code;
+    } else {
+      memset(report->KeyCode, HID_KEYBOARD_SC_ERROR_ROLLOVER, sizeof(report->KeyCode));
+      break;
+    }
+  }
+}
+#endif
+
+#if !USB_JOYSTICK_HID
+/* Fills the knob fields of a report. Only reports that go out on the IN endpoint take the
+ * latched steps; a GET_REPORT request sees zero motion. The motion of each knob is estimated
+ * once and used for both the scaling and the velocity fields. Returns true if the report
+ * carries knob motion. */
+static bool ReportsFillKnobs(USB_KnobReport_Data_t *report, bool take)
+{
+  sEncoderMotion motion[NUM_KNOBS];
+
+  for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+    EncoderGetMotion(k, &motion[k]);
+  }
+
+  if (take) {
+    /* Whatever doesn't fit in this report stays behind for the next one */
+    report->Y = -EncoderTakeDelta(KNOB_RIGHT, &motion[KNOB_RIGHT]);
+    report->X = EncoderTakeDelta(KNOB_LEFT, &motion[KNOB_LEFT]);
+  }
+
+  report->VelocityX = motion[KNOB_LEFT].velocity;
+  report->AgeX = motion[KNOB_LEFT].age_us;
+  report->VelocityY = -motion[KNOB_RIGHT].velocity;
+  report->AgeY = motion[KNOB_RIGHT].age_us;
+
+  return report->X || report->Y;
+}
+#endif
+
+/* Builds the current report for an interface into a zeroed buffer. Returns true if it must
+ * go out even when it matches the previous one, which is when it carries knob motion. */
+static bool ReportsBuild(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo, void* ReportData,
+                         uint16_t* const ReportSize, bool take)
+{
+#if USB_JOYSTICK_HID
+  USB_JoystickReport_Data_t* JoystickReport = (USB_JoystickReport_Data_t*)ReportData;
+
+  /* Absolute positions only go out when they change, nothing is taken */
+  ReportsApplyEvents(TimebaseMicros());
+  JoystickReport->Buttons = buttons_pressed >> BT_A;
+  JoystickReport->X = EncoderGetPosition(KNOB_LEFT);
+  JoystickReport->Y = -EncoderGetPosition(KNOB_RIGHT);
+
+  *ReportSize = sizeof(USB_JoystickReport_Data_t);
+  return false;
+#elif USB_COMPOSITE_HID
+  USB_KnobReport_Data_t* InputReport = (USB_KnobReport_Data_t*)ReportData;
+
+  /* Buttons and knobs are cut at the same instant, so things that happened together
+   * arrive in the same report */
+  ReportsApplyEvents(take ? EncoderLatch() : TimebaseMicros());
+  InputReport->Buttons = buttons_pressed >> BT_A;
+
+  *ReportSize = sizeof(USB_KnobReport_Data_t);
+  return ReportsFillKnobs(InputReport, take);
+#else
+  if (HIDInterfaceInfo == &Keyboard_HID_Interface) {
+    ReportsApplyEvents(TimebaseMicros());
+
+    if (HIDInterfaceInfo->State.UsingReportProtocol) {
+      ReportsFillKeyboard((uint8_t*)ReportData);
+      *ReportSize = sizeof(USB_NKROKeyboardReport_Data_t);
+    } else {
+      ReportsFillBootKeyboard((USB_KeyboardReport_Data_t*)ReportData);
+      *ReportSize = sizeof(USB_KeyboardReport_Data_t);
+    }
+    return false;
+  } else {
+    if (take) EncoderLatch();
+
+    /* Without motion the report only goes out when the velocity or age fields change,
+     * and those settle once the knob has been still for ENCODER_STOP_US */
+    *ReportSize = sizeof(USB_KnobReport_Data_t);
+    return ReportsFillKnobs((USB_KnobReport_Data_t*)ReportData, take);
+  }
+#endif
+}
+
+#if REPORTS_CHANGE_DRIVEN
+static uint8_t active_frames = 0;
+#endif
+
+/* The report written before the newest queued one, per interface */
+#if USB_SINGLE_HID
+static uReport input_base;
+#else
+static uReport keyboard_base;
+static uReport mouse_base;
+#endif
+
+static uReport *ReportsBase(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo)
+{
+#if USB_SINGLE_HID
+  return &input_base;
+#else
+  return (HIDInterfaceInfo == &Keyboard_HID_Interface) ? &keyboard_base : &mouse_base;
+#endif
+}
+
+/* Whether the next report can take the place of the last one still waiting in the endpoint.
+ * Every bit that changed in the last report must keep its new value, so no edge is lost.
+ * A report with relative knob motion is never replaced, though absolute joystick positions
+ * can be. A kill that races the host's IN token can't
+ * be told apart from a sent bank, so its motion would be lost or counted twice. It stays
+ * queued instead, and the next report waits behind it in the other bank. */
+static bool ReportsCanReplace(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
+                              const uReport *next, const uReport *base)
+{
+  const uReport *last = (const uReport *) HIDInterfaceInfo->Config.PrevReportINBuffer;
+
+#if !USB_SINGLE_HID
+  if (HIDInterfaceInfo == &Keyboard_HID_Interface) {
+    // Only the NKRO report is all bitmaps
+    if (!HIDInterfaceInfo->State.UsingReportProtocol) return false;
+
+    const uint8_t *l = (const uint8_t *) last, *b = (const uint8_t *) base, *n = (const uint8_t *) next;
+    for (uint8_t i = 0; i < sizeof(USB_NKROKeyboardReport_Data_t); i++) {
+      if ((l[i] ^ b[i]) & (n[i] ^ l[i])) return false;
+    }
+    return true;
+  }
+#endif
+
+#if !USB_JOYSTICK_HID
+  if (last->Knobs.X || last->Knobs.Y) return false;
+#endif
+  return !((last->Knobs.Buttons ^ base->Knobs.Buttons) & (next->Knobs.Buttons ^ last->Knobs.Buttons));
+}
+
+/* Kills the last bank written to the selected IN endpoint. If the host takes it first, the
+ * bank is freed all the same. */
+static inline void ReportsKillLastBank(void)
+{
+  UEINTX |= (1 << KILLBK);
+  while (UEINTX & (1 << KILLBK));
+}
+
+/* Copies a report into the bank of the selected endpoint */
+static inline void ReportsWrite(const uint8_t *data, uint8_t size)
+{
+  while (size--) Endpoint_Write_8(*data++);
+}
+
+/* Writes a fresh report straight into the interface's IN endpoint if the report changed,
+ * carries knob motion or is due for the host's idle rate. The endpoint is double banked.
+ * When a bank is free the report goes in, replacing the one still queued if that loses
+ * nothing, so the next IN token always gets the newest state. When both banks are full,
+ * nothing is taken and a later call sends it. Runs from interrupts, so the endpoint selected
+ * by whatever it interrupted is put back afterwards. The report is written byte by byte into
+ * the bank, without the stream functions' bank and timeout handling, which a report that
+ * fits in one bank doesn't need. */
+static void ReportsStage(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo)
+{
+  uReport report;
+  uint16_t size = 0;
+
+  if (USB_DeviceState != DEVICE_STATE_Configured) return;
+
+  uint8_t prev_endpoint = Endpoint_GetCurrentEndpoint();
+  Endpoint_SelectEndpoint(HIDInterfaceInfo->Config.ReportINEndpoint.Address);
+
+  uint32_t start = TimebaseNow();
+  uint8_t busy = Endpoint_GetBusyBanks();
+  if (busy < HIDInterfaceInfo->Config.ReportINEndpoint.Banks) {
+    memset(&report, 0, sizeof(report));
+    bool force = ReportsBuild(HIDInterfaceInfo, &report, &size, true);
+    bool changed = memcmp(&report, HIDInterfaceInfo->Config.PrevReportINBuffer, size) != 0;
+    bool idle = HIDInterfaceInfo->State.IdleCount && !HIDInterfaceInfo->State.IdleMSRemaining;
+
+    if (force || changed || idle) {
+      uReport *base = ReportsBase(HIDInterfaceInfo);
+      if (busy && ReportsCanReplace(HIDInterfaceInfo, &report, base)) {
+        ReportsKillLastBank();
+      } else {
+        memcpy(base, HIDInterfaceInfo->Config.PrevReportINBuffer, size);
+      }
+      memcpy(HIDInterfaceInfo->Config.PrevReportINBuffer, &report, size);
+      ReportsWrite((const uint8_t *) &report, size);
+      Endpoint_ClearIN();
+      HIDInterfaceInfo->State.IdleMSRemaining = HIDInterfaceInfo->State.IdleCount;
+      TimingRecord(TIMING_REPORT_STAGE, TimebaseNow() - start);
+      TimingRecord(TIMING_SAMPLE_TO_FRAME, DebounceGetSampleAge());
+    }
+  }
+
+  Endpoint_SelectEndpoint(prev_endpoint);
+}
+
+#if REPORTS_CHANGE_DRIVEN
+
+/* Called from interrupts right after a debounced button edge */
+void ReportsStageButtons(void)
+{
+  active_frames = REPORTS_ACTIVE_FRAMES;
+
+#if USB_SINGLE_HID
+  ReportsStage(&Input_HID_Interface);
+#else
+  ReportsStage(&Keyboard_HID_Interface);
+#endif
+}
+
+/* Called from interrupts right after a knob step */
+void ReportsStageKnobs(void)
+{
+  active_frames = REPORTS_ACTIVE_FRAMES;
+
+#if USB_SINGLE_HID
+  ReportsStage(&Input_HID_Interface);
+#else
+  ReportsStage(&Mouse_HID_Interface);
+#endif
+}
+
+/* Sends the idle repeat when the host asked for one and nothing else went out in time */
+static void ReportsStageIdle(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo)
+{
+  if (HIDInterfaceInfo->State.IdleCount && !HIDInterfaceInfo->State.IdleMSRemaining) {
+    ReportsStage(HIDInterfaceInfo);
+  }
+}
+
+#endif
+
+/* Reports are either staged from interrupts or built here on every pass of the main loop */
+void ReportsUpdate(void)
+{
+#if !REPORTS_CHANGE_DRIVEN
+  /* The control interrupt builds GET_REPORT answers from the same state */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+#if USB_SINGLE_HID
+    ReportsStage(&Input_HID_Interface);
+#else
+    ReportsStage(&Keyboard_HID_Interface);
+    ReportsStage(&Mouse_HID_Interface);
+#endif
+  }
+#endif
+}
+
+/* Counts down the host's idle rate */
+static inline void ReportsTick(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo)
+{
+  if (HIDInterfaceInfo->State.IdleMSRemaining) HIDInterfaceInfo->State.IdleMSRemaining--;
+}
+
+/* Called from the start of frame interrupt. In change driven mode this keeps staging reports
+ * for a while after an input change and sends the idle repeats. Frames with nothing going on
+ * cost only the checks. */
+void ReportsFrame(void)
+{
+#if USB_SINGLE_HID
+  ReportsTick(&Input_HID_Interface);
+#else
+  ReportsTick(&Keyboard_HID_Interface);
+  ReportsTick(&Mouse_HID_Interface);
+#endif
+
+#if REPORTS_CHANGE_DRIVEN
+  if (active_frames) {
+    active_frames--;
+#if USB_SINGLE_HID
+    ReportsStage(&Input_HID_Interface);
+#else
+    ReportsStage(&Keyboard_HID_Interface);
+    ReportsStage(&Mouse_HID_Interface);
+#endif
+  } else {
+#if USB_SINGLE_HID
+    ReportsStageIdle(&Input_HID_Interface);
+#else
+    ReportsStageIdle(&Keyboard_HID_Interface);
+    ReportsStageIdle(&Mouse_HID_Interface);
+#endif
+  }
+#endif
+}
+
+bool ReportsConfigureEndpoints(void)
+{
+  bool ConfigSuccess = true;
+
+#if USB_SINGLE_HID
+  ConfigSuccess &= HID_Device_ConfigureEndpoints(&Input_HID_Interface);
+#else
+  ConfigSuccess &= HID_Device_ConfigureEndpoints(&Keyboard_HID_Interface);
+  ConfigSuccess &= HID_Device_ConfigureEndpoints(&Mouse_HID_Interface);
+#endif
+
+  return ConfigSuccess;
+}
+
+/* Answers the HID class requests for one interface. Unlike the class driver, GET_REPORT builds
+ * into a fixed buffer and leaves the previous report alone, so the next staged report is still
+ * compared against what actually went out on the IN endpoint. Requests that are not handled
+ * here are stalled by the library. */
+static void ReportsControlRequest(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo)
+{
+  if (USB_ControlRequest.wIndex != HIDInterfaceInfo->Config.InterfaceNumber) return;
+
+  switch (USB_ControlRequest.bRequest)
+  {
+    case HID_REQ_GetReport:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        uReport report;
+        uint16_t size = 0;
+
+        // There are only input reports
+        if ((USB_ControlRequest.wValue >> 8) - 1 != HID_REPORT_ITEM_In) break;
+
+        /* The control interrupt runs with interrupts enabled, so the staging interrupts are
+         * held off while the report is built */
+        memset(&report, 0, sizeof(report));
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          ReportsBuild(HIDInterfaceInfo, &report, &size, false);
+#if REPORTS_CHANGE_DRIVEN
+          active_frames = REPORTS_ACTIVE_FRAMES;
+#endif
+        }
+
+        Endpoint_ClearSETUP();
+        Endpoint_Write_Control_Stream_LE(&report, size);
+        Endpoint_ClearOUT();
+      }
+      break;
+    case HID_REQ_SetReport:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        uint8_t report[8];
+
+        // Nothing uses the keyboard LEDs, so the output report is read and dropped
+        if (USB_ControlRequest.wLength > sizeof(report)) break;
+
+        Endpoint_ClearSETUP();
+        Endpoint_Read_Control_Stream_LE(report, USB_ControlRequest.wLength);
+        Endpoint_ClearIN();
+      }
+      break;
+    case HID_REQ_GetProtocol:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        Endpoint_ClearSETUP();
+        while (!(Endpoint_IsINReady()));
+        Endpoint_Write_8(HIDInterfaceInfo->State.UsingReportProtocol);
+        Endpoint_ClearIN();
+        Endpoint_ClearStatusStage();
+      }
+      break;
+    case HID_REQ_SetProtocol:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        Endpoint_ClearSETUP();
+        Endpoint_ClearStatusStage();
+        HIDInterfaceInfo->State.UsingReportProtocol = ((USB_ControlRequest.wValue & 0xFF) != 0x00);
+      }
+      break;
+    case HID_REQ_GetIdle:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        Endpoint_ClearSETUP();
+        while (!(Endpoint_IsINReady()));
+        Endpoint_Write_8(HIDInterfaceInfo->State.IdleCount >> 2);
+        Endpoint_ClearIN();
+        Endpoint_ClearStatusStage();
+      }
+      break;
+    case HID_REQ_SetIdle:
+      if (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_CLASS | REQREC_INTERFACE)) {
+        Endpoint_ClearSETUP();
+        Endpoint_ClearStatusStage();
+        // The idle rate comes in 4 ms units and is counted in frames
+        HIDInterfaceInfo->State.IdleCount = ((USB_ControlRequest.wValue & 0xFF00) >> 6);
+      }
+      break;
+  }
+}
+
+void ReportsProcessControlRequest(void)
+{
+  if (!(Endpoint_IsSETUPReceived())) return;
+
+#if USB_SINGLE_HID
+  ReportsControlRequest(&Input_HID_Interface);
+#else
+  ReportsControlRequest(&Keyboard_HID_Interface);
+  ReportsControlRequest(&Mouse_HID_Interface);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef REPORTS_H_
+#define REPORTS_H_
+
+#include "reports.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "descriptors.h"
+
+/* Stage a report in its IN endpoint from the interrupt that changed the input, and
+ * only when something changed, instead of building one on every pass of the main loop */
+#ifndef REPORTS_CHANGE_DRIVEN
+#define REPORTS_CHANGE_DRIVEN 1
+#endif
+
+void ReportsInit(void);
+void ReportsUpdate(void);
+void ReportsFrame(void);
+bool ReportsConfigureEndpoints(void);
+void ReportsProcessControlRequest(void);
+
+#if REPORTS_CHANGE_DRIVEN
+void ReportsStageButtons(void);
+void ReportsStageKnobs(void);
+#else
+static inline void ReportsStageButtons(void) {}
+static inline void ReportsStageKnobs(void) {}
+#endif
+
+#endif /* REPORTS_H_ */
\ No newline at end of file
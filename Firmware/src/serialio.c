@@ -0,0 +1,139 @@
+#include "serialio.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "led.h"
+
+#if USB_CDC
+
+#define SERIALIO_NUM_BUTTONS (NUM_PINS - SERIALIO_FIRST_PIN)
+
+_Static_assert(SERIALIO_NUM_BUTTONS <= 8, "buttons don't fit in the bitmap");
+_Static_assert(sizeof(sSerialInputFrame) < CDC_TXRX_EPSIZE, "input frame must be a short packet");
+
+static USB_ClassInfo_CDC_Device_t *serial_cdc;
+
+/* Output frame being received */
+static uint8_t rx[sizeof(sSerialOutputFrame)];
+static uint8_t rx_length = 0;
+
+/* Set by the first good frame; cleared in the main loop once the host drops DTR */
+static bool active = false;
+static volatile bool close_pending = false;
+
+static uint8_t sequence;
+static uint8_t dropped;
+static uint8_t bad_frames;
+
+void SerialIoInit(USB_ClassInfo_CDC_Device_t *cdc)
+{
+  serial_cdc = cdc;
+}
+
+static uint8_t SerialIoSum(const uint8_t *data, uint8_t length)
+{
+  uint8_t sum = 0;
+
+  for (uint8_t i = 0; i < length; i++) {
+    sum += data[i];
+  }
+  return sum;
+}
+
+/* Writes the frame into the CDC IN bank and sends it at once, or drops it if the bank has no
+ * room because the host isn't reading. Never waits on the host. The bank must end up short of
+ * full, so the packet is short and the host driver hands it over without waiting for more. */
+static void SerialIoSend(sSerialInputFrame *frame)
+{
+  frame->sequence = sequence++;
+  frame->dropped = dropped;
+  frame->checksum = 0;
+  frame->checksum = -SerialIoSum((const uint8_t *) frame, sizeof(*frame));
+
+  if (USB_DeviceState != DEVICE_STATE_Configured || !serial_cdc->State.LineEncoding.BaudRateBPS) {
+    dropped++;
+    return;
+  }
+
+  Endpoint_SelectEndpoint(CDC_TX_EPADDR);
+  if (!Endpoint_IsINReady() || Endpoint_BytesInEndpoint() >= CDC_TXRX_EPSIZE - sizeof(*frame)) {
+    dropped++;
+    return;
+  }
+
+  const uint8_t *data = (const uint8_t *) frame;
+  for (uint8_t i = 0; i < sizeof(*frame); i++) {
+    Endpoint_Write_8(data[i]);
+  }
+  Endpoint_ClearIN();
+}
+
+static void SerialIoRun(const sSerialOutputFrame *output)
+{
+  sSerialInputFrame input;
+
+  LedSetHostLights(output->flags & SERIALIO_FLAG_LIGHTS, output->lights);
+
+  input.sync = SERIALIO_SYNC;
+  input.host_sequence = output->sequence;
+  input.buttons = 0;
+  for (uint8_t b = 0; b < SERIALIO_NUM_BUTTONS; b++) {
+    if (!DebounceGetLevel(SERIALIO_FIRST_PIN + b)) input.buttons |= (1 << b);
+  }
+  for (eKnobId k = 0; k < NUM_KNOBS; k++) {
+    input.knob[k] = EncoderGetPosition(k);
+  }
+  input.sample_time_us = DebounceGetSampleTime();
+  input.bad_frames = bad_frames;
+  SerialIoSend(&input);
+}
+
+/* Takes a byte from the serial port. Returns false if it isn't part of a frame, in which case
+ * it is the console's. */
+bool SerialIoProcessByte(int16_t c)
+{
+  if (c < 0) return false;
+
+  if (!rx_length && c != SERIALIO_SYNC) {
+    // Out of step; skip to the next sync byte
+    return active;
+  }
+
+  rx[rx_length++] = c;
+  if (rx_length < sizeof(rx)) return true;
+  rx_length = 0;
+
+  if (SerialIoSum(rx, sizeof(rx))) {
+    bad_frames++;
+    return true;
+  }
+
+  active = true;
+  SerialIoRun((const sSerialOutputFrame *) rx);
+  return true;
+}
+
+bool SerialIoActive(void)
+{
+  return active;
+}
+
+/* Ends the session once the host has closed the port, giving the lights back to the buttons */
+void SerialIoUpdate(void)
+{
+  if (!close_pending) return;
+  close_pending = false;
+
+  active = false;
+  rx_length = 0;
+  LedSetHostLights(false, 0);
+}
+
+/* Called when the host drops DTR; safe from the control request interrupt */
+void SerialIoClose(void)
+{
+  close_pending = true;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef SERIALIO_H_
+#define SERIALIO_H_
+
+#include "serialio.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <LUFA/Drivers/USB/USB.h>
+#include "descriptors.h"
+#include "encoder.h"
+
+/* Binary polled IO on the CDC serial port, for arcade IO host software. The host writes an
+ * output frame and gets one input frame back. Every frame has a fixed size, starts with
+ * SERIALIO_SYNC and ends with a checksum that makes its bytes sum to zero. SERIALIO_SYNC is not
+ * ASCII, so the console keeps the port until the first good frame. From then until the host
+ * drops DTR, every byte belongs to the protocol. */
+
+#define SERIALIO_SYNC 0xA5
+
+/* Output frame flags */
+#define SERIALIO_FLAG_LIGHTS 0x01   // The host drives the button lights
+
+/* Buttons in the bitmaps, starting at ePinId SERIALIO_FIRST_PIN */
+#define SERIALIO_FIRST_PIN BT_A
+
+/* Output frame from the host */
+typedef struct {
+  uint8_t sync;             // SERIALIO_SYNC
+  uint8_t sequence;         // Echoed in the input frame
+  uint8_t flags;            // SERIALIO_FLAG_*
+  uint8_t lights;           // Bit n lights the button at SERIALIO_FIRST_PIN + n, with SERIALIO_FLAG_LIGHTS
+  uint8_t checksum;
+} __attribute__((packed)) sSerialOutputFrame;
+
+/* Input frame to the host, one per output frame. It is kept shorter than the CDC endpoint so it
+ * always ends in a short packet, which is what completes a bulk read on the host. */
+typedef struct {
+  uint8_t sync;             // SERIALIO_SYNC
+  uint8_t sequence;         // Counts up by one per frame, dropped ones included, so gaps show drops
+  uint8_t host_sequence;    // Sequence of the output frame it answers
+  uint8_t buttons;          // Bit n set while the button at SERIALIO_FIRST_PIN + n is pressed
+  uint16_t knob[NUM_KNOBS]; // Knob positions in encoder steps, see EncoderGetPosition()
+  uint32_t sample_time_us;  // TimebaseMicros() at the newest sample
+  uint8_t dropped;          // Input frames dropped because the host wasn't reading, wrapping
+  uint8_t bad_frames;       // Output frames with a bad checksum, wrapping
+  uint8_t checksum;
+} __attribute__((packed)) sSerialInputFrame;
+
+void SerialIoInit(USB_ClassInfo_CDC_Device_t *cdc);
+bool SerialIoProcessByte(int16_t c);
+bool SerialIoActive(void);
+void SerialIoUpdate(void);
+void SerialIoClose(void);
+
+#endif /* SERIALIO_H_ */
\ No newline at end of file
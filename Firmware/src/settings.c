@@ -0,0 +1,115 @@
+#include "settings.h"
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <string.h>
+#include <LUFA/Drivers/USB/USB.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "descriptors.h"
+
+#define SETTINGS_DEFAULT_KEYS \
+  { \
+    [BT_A - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_S, \
+    [BT_B - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_D, \
+    [BT_C - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_K, \
+    [BT_D - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_L, \
+    [FX_L - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_V, \
+    [FX_R - KEYMAP_FIRST_PIN]  = HID_KEYBOARD_SC_M, \
+    [START - KEYMAP_FIRST_PIN] = HID_KEYBOARD_SC_ENTER, \
+  }
+
+static const sSettings default_settings PROGMEM =
+{
+  .version = SETTINGS_VERSION,
+  .trigger_count =
+  {
+    [ENC_LEFT_A]  = DEBOUNCE_TRIGGER_COUNT_ENCODER,
+    [ENC_LEFT_B]  = DEBOUNCE_TRIGGER_COUNT_ENCODER,
+    [ENC_RIGHT_A] = DEBOUNCE_TRIGGER_COUNT_ENCODER,
+    [ENC_RIGHT_B] = DEBOUNCE_TRIGGER_COUNT_ENCODER,
+    [BT_A]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [BT_B]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [BT_C]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [BT_D]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [FX_L]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [FX_R]        = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+    [START]       = DEBOUNCE_TRIGGER_COUNT_BUTTON,
+  },
+  .knob_gain =
+  {
+    [KNOB_LEFT]  = ENCODER_GAIN_UNITY,
+    [KNOB_RIGHT] = ENCODER_GAIN_UNITY,
+  },
+  .knob_accel =
+  {
+    ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY,
+    ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY, ENCODER_ACCEL_UNITY,
+  },
+  .usb_profile = USB_PROFILE_Full,
+  /* Both layers start out the same, so holding START changes nothing until it is rebound */
+  .keymap =
+  {
+    [0] = SETTINGS_DEFAULT_KEYS,
+    [1] = SETTINGS_DEFAULT_KEYS,
+  },
+};
+
+static sSettings EEMEM eeprom_settings;
+
+sSettings settings;
+
+/* Offset of the next byte to compare against EEPROM, or sizeof(sSettings) when in sync */
+static uint8_t save_offset = sizeof(sSettings);
+
+void SettingsInit(void)
+{
+  eeprom_read_block(&settings, &eeprom_settings, sizeof(sSettings));
+  if (settings.version != SETTINGS_VERSION) {
+    SettingsRestoreDefaults();
+  }
+}
+
+void SettingsRestoreDefaults(void)
+{
+  memcpy_P(&settings, &default_settings, sizeof(sSettings));
+  SettingsSave();
+}
+
+/* Restores the defaults at run time and hands them to the modules that keep their own copy.
+ * Reports read the knob settings from interrupts, so the copy is atomic. */
+void SettingsApplyDefaults(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memcpy_P(&settings, &default_settings, sizeof(sSettings));
+  }
+  SettingsSave();
+
+  for (ePinId p = 0; p < NUM_PINS; p++) {
+    DebounceSetTriggerCount(p, settings.trigger_count[p]);
+  }
+  KeymapCompile();
+}
+
+void SettingsSave(void)
+{
+  save_offset = 0;
+}
+
+/* Writes back at most one changed byte per call and never waits on the EEPROM,
+ * so saving settings does not stall the main loop for the ~3.4 ms a write takes */
+void SettingsUpdate(void)
+{
+  while (save_offset < sizeof(sSettings)) {
+    if (!eeprom_is_ready()) return;
+
+    uint8_t *eeprom = (uint8_t *) &eeprom_settings + save_offset;
+    uint8_t value = ((uint8_t *) &settings)[save_offset];
+    save_offset++;
+    if (eeprom_read_byte(eeprom) != value) {
+      eeprom_write_byte(eeprom, value);
+      return;
+    }
+  }
+}
\ No newline at end of file
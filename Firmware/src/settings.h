@@ -0,0 +1,32 @@
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include "settings.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debounce.h"
+#include "encoder.h"
+#include "keymap.h"
+
+/* Bump whenever sSettings changes layout; stored settings from another version are discarded */
+#define SETTINGS_VERSION 4
+
+typedef struct {
+  uint8_t version;
+  uint8_t trigger_count[NUM_PINS];
+  uint16_t knob_gain[NUM_KNOBS]; /* Q8.8 report counts per step */
+  uint8_t knob_accel[ENCODER_ACCEL_BANDS]; /* Q4.4 multiplier per speed band */
+  uint8_t usb_profile; /* USB_Profiles_t used from the next plug-in; holding START picks the other one */
+  uint8_t keymap[KEYMAP_LAYERS][KEYMAP_NUM_KEYS]; /* HID usage per key and layer, last so it can be sent on its own */
+} sSettings;
+
+extern sSettings settings;
+
+void SettingsInit(void);
+void SettingsUpdate(void);
+void SettingsSave(void);
+void SettingsRestoreDefaults(void);
+void SettingsApplyDefaults(void);
+
+#endif /* SETTINGS_H_ */
\ No newline at end of file
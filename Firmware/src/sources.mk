@@ -1,7 +1,18 @@
-PROJECT_SRC   := src/debounce.c \
+PROJECT_SRC   := src/console.c \
+                 src/debounce.c \
                  src/descriptors.c \
                  src/encoder.c \
+                 src/events.c \
+                 src/health.c \
+                 src/keymap.c \
                  src/led.c \
                  src/neopixel.c \
                  src/pins.c \
+                 src/power.c \
+                 src/rawhid.c \
+                 src/reports.c \
+                 src/serialio.c \
+                 src/settings.c \
+                 src/timebase.c \
+                 src/timing.c \
                  src/note.c \
@@ -0,0 +1,60 @@
+#include "timebase.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+
+static volatile uint32_t overflows = 0;
+
+void TimebaseInit(void)
+{
+  /* Free-running Timer1 at the CPU clock, extended to 32 bits by the overflow interrupt */
+  TCCR1A = 0;                              // Normal mode, no compare outputs
+  TCNT1 = 0;                               // Reset timer count
+  TIFR1 = (1 << TOV1);                     // Clear overflow flag
+  TIMSK1 |= (1 << TOIE1);                  // Count overflows (every 4.096 ms)
+  TCCR1B = (1 << CS10);                    // Select clock : no prescale -> 16 MHz
+}
+
+ISR(TIMER1_OVF_vect)
+{
+  overflows++;
+}
+
+uint16_t TimebaseCycles(void)
+{
+  // Wraps every 4.096 ms; only use for measuring intervals shorter than that
+  return TCNT1;
+}
+
+/* CPU cycles since TimebaseInit(), wrapping after about 268 seconds */
+uint32_t TimebaseNow(void)
+{
+  uint16_t high;
+  uint16_t low;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    high = overflows;
+    low = TCNT1;
+    // Overflowed but not yet counted (interrupts are off, or we are inside another ISR)
+    if ((TIFR1 & (1 << TOV1)) && low < 0x8000) high++;
+  }
+
+  return ((uint32_t) high << 16) | low;
+}
+
+/* Microseconds since TimebaseInit(), wrapping after about 71 minutes */
+uint32_t TimebaseMicros(void)
+{
+  uint32_t high;
+  uint16_t low;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    high = overflows;
+    low = TCNT1;
+    if ((TIFR1 & (1 << TOV1)) && low < 0x8000) high++;
+  }
+
+  // One overflow is 65536 cycles, exactly 4096 us at 16 MHz
+  return (high << 12) | (low / TIMEBASE_CYCLES_PER_US);
+}
\ No newline at end of file
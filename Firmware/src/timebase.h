@@ -0,0 +1,14 @@
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include "timebase.h"
+#include <stdint.h>
+
+#define TIMEBASE_CYCLES_PER_US (F_CPU / 1000000)
+
+void TimebaseInit(void);
+uint16_t TimebaseCycles(void);
+uint32_t TimebaseNow(void);
+uint32_t TimebaseMicros(void);
+
+#endif /* TIMEBASE_H_ */
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "timing.h"
+#include <util/atomic.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "timebase.h"
+
+/* Fixed-size, integer-only histograms. A bucket that would overflow halves
+ * every bucket of its histogram, which keeps the percentiles intact. */
+typedef struct {
+  uint16_t buckets[TIMING_BUCKETS];
+  uint32_t count;
+  uint32_t max;
+} sHistogram;
+
+static sHistogram histograms[NUM_TIMINGS];
+
+static uint32_t loop_previous;
+static bool loop_started = false;
+
+void TimingInit(void)
+{
+  TimingReset();
+}
+
+static uint8_t TimingBucket(uint32_t cycles)
+{
+  if (cycles < 16) return 0;
+
+  uint8_t octave = 0;
+  while (cycles >= 4) {
+    cycles >>= 1;
+    octave++;
+  }
+  // cycles is now 2 or 3: the lower or upper half of the octave
+  uint8_t bucket = 2 * octave + (uint8_t) cycles - 7;
+  return bucket < TIMING_BUCKETS ? bucket : TIMING_BUCKETS - 1;
+}
+
+/* Exclusive upper bound of a bucket, in cycles */
+static uint32_t TimingBucketLimit(uint8_t bucket)
+{
+  if (bucket == 0) return 16;
+  if (bucket == TIMING_BUCKETS - 1) return UINT32_MAX;
+
+  if (bucket & 1) return 3UL << ((bucket + 5) / 2);
+  return 4UL << ((bucket + 4) / 2);
+}
+
+void TimingRecord(eTimingId id, uint32_t cycles)
+{
+  sHistogram *h = &histograms[id];
+  uint16_t *bucket = &h->buckets[TimingBucket(cycles)];
+
+  if (*bucket == UINT16_MAX) {
+    for (uint8_t b = 0; b < TIMING_BUCKETS; b++) {
+      h->buckets[b] >>= 1;
+    }
+  }
+  (*bucket)++;
+  h->count++;
+  if (cycles > h->max) h->max = cycles;
+}
+
+/* Called once per main loop iteration */
+void TimingLoop(void)
+{
+  uint32_t now = TimebaseNow();
+  if (loop_started) {
+    TimingRecord(TIMING_LOOP, now - loop_previous);
+  }
+  loop_previous = now;
+  loop_started = true;
+}
+
+static uint32_t TimingPercentile(const sHistogram *h, uint32_t total, uint8_t percent)
+{
+  uint32_t target = (total * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < TIMING_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= target) {
+      uint32_t limit = TimingBucketLimit(b);
+      return limit < h->max ? limit : h->max;
+    }
+  }
+  return h->max;
+}
+
+void TimingGet(eTimingId id, sTimingSummary *summary)
+{
+  sHistogram h;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    h = histograms[id];
+  }
+
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < TIMING_BUCKETS; b++) {
+    total += h.buckets[b];
+  }
+
+  summary->count = h.count;
+  summary->max = h.max;
+  summary->p50 = TimingPercentile(&h, total, 50);
+  summary->p99 = TimingPercentile(&h, total, 99);
+}
+
+void TimingReset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(histograms, 0, sizeof(histograms));
+    loop_started = false;
+  }
+}
\ No newline at end of file
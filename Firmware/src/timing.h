@@ -0,0 +1,35 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include "timing.h"
+#include <stdint.h>
+
+/* Half-octave buckets: bucket 0 holds everything below 16 cycles (1 us), the
+ * last bucket everything from 2^24 cycles (~1 s) up */
+#define TIMING_BUCKETS 42
+
+typedef enum {
+  TIMING_LOOP = 0,        // Main loop iteration time
+  TIMING_SAMPLE_LATENESS, // Delay from sample timer compare match to sampling
+  TIMING_SAMPLE_COST,     // Time spent in the sample interrupt
+  TIMING_EDGE_TO_REPORT,  // Delay from a debounced button edge to the keyboard report carrying it
+  TIMING_USB,             // USB work in one main loop iteration
+  TIMING_REPORT_STAGE,    // Time to build and write one HID report into its endpoint
+  TIMING_SAMPLE_TO_FRAME, // Age of the newest sample in a staged report at the next frame start
+  NUM_TIMINGS
+} eTimingId;
+
+typedef struct {
+  uint32_t count;
+  uint32_t p50;           // Upper bound of the bucket holding the median, in cycles
+  uint32_t p99;           // ... the 99th percentile, in cycles
+  uint32_t max;           // Exact maximum, in cycles
+} sTimingSummary;
+
+void TimingInit(void);
+void TimingLoop(void);
+void TimingRecord(eTimingId id, uint32_t cycles);
+void TimingGet(eTimingId id, sTimingSummary *summary);
+void TimingReset(void);
+
+#endif /* TIMING_H_ */
\ No newline at end of file